@@ -0,0 +1,151 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <fstream>
+#include <vector>
+#include <numeric>
+#include <ostream>
+#include <algorithm>
+
+#include "hw_counters.hpp"
+#include "global_aliases.hpp"
+
+namespace benchmark {
+  using clock = std::chrono::steady_clock;
+
+  struct Sample_Stats {
+    double median = 0.0;
+    double mean = 0.0;
+    double stddev = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+    // Half width of the 95% confidence interval of the mean.
+    double ci95 = 0.0;
+  };
+
+  Sample_Stats summarise(std::vector<double> samples) {
+    Sample_Stats stats{};
+    if (samples.empty()) {
+      return stats;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto n = samples.size();
+    stats.min = samples.front();
+    stats.max = samples.back();
+    stats.median = (n % 2 == 1) ? samples[n / 2] : 0.5 * (samples[n / 2 - 1] + samples[n / 2]);
+    stats.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / n;
+    if (n > 1) {
+      double sq_sum = 0.0;
+      for (auto s : samples) {
+        sq_sum += (s - stats.mean) * (s - stats.mean);
+      }
+      stats.stddev = std::sqrt(sq_sum / (n - 1));
+      stats.ci95 = 1.96 * stats.stddev / std::sqrt(double(n));
+    }
+    return stats;
+  }
+
+  /*
+    Runs fun warmup + repetitions times and returns the wall time in seconds of
+    each timed repetition.
+  */
+  template <typename Fun>
+  std::vector<double> repeat(size_t repetitions, size_t warmup, Fun&& fun) {
+    for (size_t i = 0; i < warmup; i++) {
+      fun();
+    }
+    std::vector<double> samples{};
+    samples.reserve(repetitions);
+    for (size_t i = 0; i < repetitions; i++) {
+      auto start = clock::now();
+      fun();
+      auto stop = clock::now();
+      samples.push_back(std::chrono::duration<double>(stop - start).count());
+    }
+    return samples;
+  }
+
+  long current_rss_kb() {
+    std::ifstream statm{ "/proc/self/statm" };
+    long size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+  }
+
+  struct Result {
+    std::string container;
+    std::string measure;
+    size_t size;
+    double overlap;
+    // Operations (kmers loaded, lookups, pairs) performed per repetition.
+    size_t ops;
+    size_t repetitions;
+    Sample_Stats seconds;
+    // Hardware counters of one extra repetition, with the probes and matched contexts it performed.
+    hw_counters::Sample hw{};
+    double probes = 0.0;
+    double matched = 0.0;
+    // Heap allocations made and still held by a load, and the resident memory it added.
+    double allocations = 0.0;
+    double live_allocations = 0.0;
+    double rss_kb = 0.0;
+    // Probability storage and accumulation precision of the build.
+    std::string precision = precision_name;
+    // Maximum context length of the generated VLMCs, 0 if not generated.
+    size_t max_depth = 0;
+
+    double ns_per_op() const { return ops == 0 ? 0.0 : seconds.median * 1e9 / ops; }
+    double ops_per_second() const { return seconds.median == 0 ? 0.0 : ops / seconds.median; }
+  };
+
+  std::string per(const hw_counters::Sample& hw, size_t event, double count) {
+    if (!hw.valid[event] || count <= 0) {
+      return "";
+    }
+    return std::to_string(hw.values[event] / count);
+  }
+
+  void write_csv(std::ostream& os, const std::vector<Result>& results) {
+    os << "container,measure,size,overlap,ops,repetitions,median_s,mean_s,stddev_s,min_s,max_s,ci95_s,ns_per_op,ops_per_s,allocations,live_allocations,rss_kb,precision,max_depth";
+    for (auto name : hw_counters::event_names) {
+      os << "," << name << "_per_probe," << name << "_per_match";
+    }
+    os << "\n";
+    for (auto& r : results) {
+      os << r.container << "," << r.measure << "," << r.size << "," << r.overlap << "," << r.ops << ","
+        << r.repetitions << "," << r.seconds.median << "," << r.seconds.mean << "," << r.seconds.stddev << ","
+        << r.seconds.min << "," << r.seconds.max << "," << r.seconds.ci95 << "," << r.ns_per_op() << ","
+        << r.ops_per_second() << "," << r.allocations << "," << r.live_allocations << "," << r.rss_kb << "," << r.precision << "," << r.max_depth;
+      for (size_t e = 0; e < hw_counters::nr_events; e++) {
+        os << "," << per(r.hw, e, r.probes) << "," << per(r.hw, e, r.matched);
+      }
+      os << "\n";
+    }
+  }
+
+  void write_json(std::ostream& os, const std::vector<Result>& results) {
+    os << "[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+      auto& r = results[i];
+      os << "  {\"container\": \"" << r.container << "\", \"measure\": \"" << r.measure << "\", \"size\": " << r.size
+        << ", \"overlap\": " << r.overlap << ", \"ops\": " << r.ops << ", \"repetitions\": " << r.repetitions
+        << ", \"median_s\": " << r.seconds.median << ", \"mean_s\": " << r.seconds.mean
+        << ", \"stddev_s\": " << r.seconds.stddev << ", \"min_s\": " << r.seconds.min
+        << ", \"max_s\": " << r.seconds.max << ", \"ci95_s\": " << r.seconds.ci95
+        << ", \"ns_per_op\": " << r.ns_per_op() << ", \"ops_per_s\": " << r.ops_per_second()
+        << ", \"allocations\": " << r.allocations << ", \"live_allocations\": " << r.live_allocations
+        << ", \"rss_kb\": " << r.rss_kb << ", \"precision\": \"" << r.precision << "\""
+        << ", \"max_depth\": " << r.max_depth;
+      if (r.hw.any_valid()) {
+        os << ", \"hw_counters\": " << hw_counters::to_json(r.hw, { { { "probe", r.probes }, { "match", r.matched } } });
+      }
+      os << "}"
+        << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    os << "]\n";
+  }
+}
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <streambuf>
+#include <filesystem>
+#include <string_view>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*
+  Many VLMCs in one file for the 'pack' and 'unpack' subcommands, so that a
+  collection is opened and read as one file instead of one per VLMC. Layout:
+    header  magic "DVSBNDL1", uint64 number of members, uint64 index offset
+    data    the .bintree files, concatenated
+    index   per member uint64 offset, uint64 size, uint32 name length, name
+  all little endian. An opened bundle is mapped once, and its members are
+  addressed as <bundle path>/<name>, which the loaders read from the mapping.
+*/
+namespace bundle {
+  constexpr char magic[8] = { 'D', 'V', 'S', 'B', 'N', 'D', 'L', '1' };
+  constexpr size_t header_size = sizeof(magic) + 2 * sizeof(uint64_t);
+
+  struct Member {
+    std::string name;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  // Names are relative paths that stay below the bundle or the directory they are unpacked into.
+  bool valid_name(const std::string& name) {
+    std::filesystem::path name_path{ name };
+    if (name.empty() || name_path.has_root_name() || name_path.has_root_directory()) {
+      return false;
+    }
+    for (auto& part : name_path) {
+      if (part == "..") {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Throws unless every name is valid and no two are the same.
+  void check_names(const std::vector<std::string>& names, const std::string& bundle_path) {
+    std::unordered_set<std::string> seen{};
+    for (auto& name : names) {
+      if (!valid_name(name)) {
+        throw std::runtime_error("Invalid member name '" + name + "' in bundle " + bundle_path);
+      }
+      if (!seen.insert(name).second) {
+        throw std::runtime_error("Duplicate member name '" + name + "' in bundle " + bundle_path);
+      }
+    }
+  }
+
+  class Bundle {
+  private:
+    const char* data = nullptr;
+    size_t size = 0;
+    std::vector<char> copy{};
+
+  public:
+    std::filesystem::path path;
+    std::vector<Member> members{};
+
+    explicit Bundle(const std::filesystem::path& path) : path(path) {
+#if defined(__linux__)
+      int fd = ::open(path.c_str(), O_RDONLY);
+      struct stat st {};
+      if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+          ::close(fd);
+        }
+        throw std::runtime_error("Could not open bundle " + path.string());
+      }
+      size = st.st_size;
+      if (size > 0) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+          throw std::runtime_error("Could not map bundle " + path.string());
+        }
+        // The whole bundle is read, in order.
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        madvise(mapped, size, MADV_WILLNEED);
+        data = static_cast<const char*>(mapped);
+      }
+      else {
+        ::close(fd);
+      }
+#else
+      std::ifstream is{ path, std::ios::binary };
+      copy.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+      data = copy.data();
+      size = copy.size();
+#endif
+      try {
+        read_index();
+      }
+      catch (...) {
+        unmap();
+        throw;
+      }
+    }
+
+    ~Bundle() { unmap(); }
+
+    Bundle(const Bundle&) = delete;
+    Bundle& operator=(const Bundle&) = delete;
+
+    std::string_view bytes(const Member& member) const { return { data + member.offset, member.size }; }
+
+  private:
+    void unmap() {
+#if defined(__linux__)
+      if (data != nullptr) {
+        munmap(const_cast<char*>(data), size);
+      }
+#endif
+    }
+
+    template <typename T>
+    T read_at(size_t offset) const {
+      if (offset > size || sizeof(T) > size - offset) {
+        throw std::runtime_error("Truncated bundle " + path.string());
+      }
+      T value;
+      std::memcpy(&value, data + offset, sizeof(T));
+      return value;
+    }
+
+    void read_index() {
+      if (size < header_size || std::memcmp(data, magic, sizeof(magic)) != 0) {
+        throw std::runtime_error(path.string() + " is not a bundle.");
+      }
+      auto nr_members = read_at<uint64_t>(sizeof(magic));
+      size_t offset = read_at<uint64_t>(sizeof(magic) + sizeof(uint64_t));
+      for (uint64_t i = 0; i < nr_members; i++) {
+        Member member{};
+        member.offset = read_at<uint64_t>(offset);
+        member.size = read_at<uint64_t>(offset + 8);
+        auto name_size = read_at<uint32_t>(offset + 16);
+        offset += 20;
+        // Written as differences so that offsets from a corrupt index can not wrap around.
+        if (name_size > size - offset || member.offset > size || member.size > size - member.offset) {
+          throw std::runtime_error("Truncated bundle " + path.string());
+        }
+        member.name.assign(data + offset, name_size);
+        offset += name_size;
+        members.push_back(std::move(member));
+      }
+      std::vector<std::string> names{};
+      for (auto& member : members) {
+        names.push_back(member.name);
+      }
+      check_names(names, path.string());
+    }
+  };
+
+  // Reads a member in place.
+  class Memory_Buffer : public std::streambuf {
+  public:
+    void set(std::string_view bytes) {
+      char* begin = const_cast<char*>(bytes.data());
+      setg(begin, begin, begin + bytes.size());
+    }
+  };
+
+  // Bundles opened by this process and their members, by path.
+  struct Registry {
+    std::shared_mutex mutex{};
+    std::unordered_map<std::string, std::shared_ptr<const Bundle>> bundles{};
+    std::unordered_map<std::string, std::string_view> members{};
+  };
+  inline Registry registry{};
+
+  bool is_bundle(const std::filesystem::path& path) {
+    if (!std::filesystem::is_regular_file(path)) {
+      return false;
+    }
+    std::ifstream is{ path, std::ios::binary };
+    char start[sizeof(magic)] = {};
+    is.read(start, sizeof(magic));
+    return is && std::memcmp(start, magic, sizeof(magic)) == 0;
+  }
+
+  // Maps the bundle, once per process, and returns the paths of its members, in bundle order.
+  std::vector<std::filesystem::path> open(const std::filesystem::path& path) {
+    std::unique_lock lock{ registry.mutex };
+    auto it = registry.bundles.find(path.string());
+    bool opened = it != registry.bundles.end();
+    auto bundle = opened ? it->second : std::make_shared<const Bundle>(path);
+    if (!opened) {
+      registry.bundles.emplace(path.string(), bundle);
+    }
+    std::vector<std::filesystem::path> paths{};
+    for (auto& member : bundle->members) {
+      paths.push_back(path / member.name);
+      if (!opened) {
+        registry.members[paths.back().string()] = bundle->bytes(member);
+      }
+    }
+    return paths;
+  }
+
+  // The bytes of path if it is a member of an opened bundle.
+  std::optional<std::string_view> find_member(const std::filesystem::path& path) {
+    std::shared_lock lock{ registry.mutex };
+    if (registry.members.empty()) {
+      return std::nullopt;
+    }
+    auto it = registry.members.find(path.string());
+    if (it == registry.members.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+
+  template <typename T>
+  void write_value(std::ostream& os, T value) {
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  // Packs the files under the names given, the index follows the data so that it is written in one pass.
+  void pack(const std::vector<std::filesystem::path>& paths, const std::vector<std::string>& names,
+    const std::filesystem::path& out_path) {
+    check_names(names, out_path.string());
+    std::vector<char> buffer(1 << 22);
+    std::ofstream os{};
+    os.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+    os.open(out_path, std::ios::binary);
+    os.write(magic, sizeof(magic));
+    write_value<uint64_t>(os, paths.size());
+    write_value<uint64_t>(os, 0);
+
+    std::vector<Member> members{};
+    uint64_t offset = header_size;
+    for (size_t i = 0; i < paths.size(); i++) {
+      std::string bytes{};
+      if (auto member = find_member(paths[i])) {
+        bytes = std::string(*member);
+      }
+      else {
+        std::ifstream is{ paths[i], std::ios::binary };
+        bytes.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+      }
+      os.write(bytes.data(), bytes.size());
+      members.push_back({ names[i], offset, bytes.size() });
+      offset += bytes.size();
+    }
+    for (auto& member : members) {
+      write_value<uint64_t>(os, member.offset);
+      write_value<uint64_t>(os, member.size);
+      write_value<uint32_t>(os, member.name.size());
+      os.write(member.name.data(), member.name.size());
+    }
+    os.seekp(sizeof(magic) + sizeof(uint64_t));
+    write_value<uint64_t>(os, offset);
+    os.close();
+    if (!os) {
+      throw std::runtime_error("Could not write bundle " + out_path.string());
+    }
+  }
+
+  // Writes every member to directory/name, the names were checked when the bundle was read.
+  size_t unpack(const std::filesystem::path& path, const std::filesystem::path& directory) {
+    Bundle bundle{ path };
+    for (auto& member : bundle.members) {
+      auto out_path = directory / member.name;
+      std::filesystem::create_directories(out_path.parent_path());
+      std::ofstream os{ out_path, std::ios::binary };
+      auto bytes = bundle.bytes(member);
+      os.write(bytes.data(), bytes.size());
+      if (!os) {
+        throw std::runtime_error("Could not write " + out_path.string());
+      }
+    }
+    return bundle.members.size();
+  }
+}
@@ -2,6 +2,10 @@
 
 #include <Eigen/Core>
 #include <mutex>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
 
 #include "cluster_container.hpp"
 #include "vlmc_container.hpp"
@@ -9,92 +13,249 @@
 #include "distances/dvstar.hpp"
 #include "global_aliases.hpp"
 #include "utils.hpp"
+#include "perf_report.hpp"
+#include "trace.hpp"
+#include "shard.hpp"
 
 namespace calc_dist {
   using kmer_pair = cluster_container::Kmer_Pair;
 
-  template <typename VC>
-  void calculate_triangle_slice(
-    int x1, int y1, int x2, int y2, int x3, int y3, matrix_t& distances,
-    cluster_container::Cluster_Container<VC>& cluster_left, cluster_container::Cluster_Container<VC>& cluster_right) {
+  using distances_t = std::vector<matrix_t>;
 
-    auto rec_fun = [&](int left, int right) {
-      if (distances(left, right) == 0) {
-        distances(left, right) = distance::dvstar<VC>(cluster_left.get(left), cluster_right.get(right));
-      }
-    };
+  template <typename... Metrics>
+  inline void store(distances_t& distances, size_t left, size_t right, const std::array<out_t, sizeof...(Metrics)>& values) {
+    for (size_t m = 0; m < values.size(); m++) {
+      distances[m](left, right) = values[m];
+    }
+  }
 
-    if (x1 < x2) {
-      if (y2 > y3) {
-        utils::triangle_recursion(x1, x3, y1, y2, x1, y1, x2, y2, x3, y3, rec_fun);
-      }
-      else {
-        utils::triangle_recursion(x1, x3, y1, y3, x1, y1, x2, y2, x3, y3, rec_fun);
+  /*
+    Pairs of left with the VLMCs [right_start, right_stop), handed to
+    store_pair(right, values). Containers with sorted kmers intersect left
+    with distance::block_size right VLMCs at a time, except for pairs of very
+    different sizes, which sbs gallops through pairwise. Without block_kernel
+    every pair is intersected on its own, which bench compares against.
+  */
+  template <typename VC, typename... Metrics, typename Store>
+  void calculate_row(VC& left, cluster_container::Cluster_Container<VC>& cluster_right, size_t right_start, size_t right_stop,
+    Store&& store_pair, bool block_kernel = true) {
+    if constexpr (vlmc_container::has_sorted_kmers<VC>) {
+      if (block_kernel) {
+        VC* rights[distance::block_size];
+        size_t indices[distance::block_size];
+        std::array<out_t, sizeof...(Metrics)> values[distance::block_size];
+        int count = 0;
+        auto flush = [&]() {
+          distance::fused_block<VC, Metrics...>(left, rights, count, values);
+          for (int b = 0; b < count; b++) {
+            store_pair(indices[b], values[b]);
+          }
+          count = 0;
+        };
+        for (size_t right = right_start; right < right_stop; right++) {
+          VC& right_vlmc = cluster_right.get(right);
+          bool skewed = std::is_same_v<VC, vlmc_container::VLMC_sorted_search> &&
+            (left.size() * vlmc_container::gallop_ratio <= right_vlmc.size() || right_vlmc.size() * vlmc_container::gallop_ratio <= left.size());
+          if (skewed) {
+            store_pair(right, distance::fused<VC, Metrics...>(left, right_vlmc));
+            continue;
+          }
+          rights[count] = &right_vlmc;
+          indices[count++] = right;
+          if (count == distance::block_size) {
+            flush();
+          }
+        }
+        if (count > 0) {
+          flush();
+        }
+        return;
       }
     }
-    else {
-      if (y2 > y3) {
-        utils::triangle_recursion(x2, x3, y1, y2, x1, y1, x2, y2, x3, y3, rec_fun);
-      }
-      else {
-        utils::triangle_recursion(x2, x3, y1, y3, x1, y1, x2, y2, x3, y3, rec_fun);
-      }
+    for (size_t right = right_start; right < right_stop; right++) {
+      store_pair(right, distance::fused<VC, Metrics...>(left, cluster_right.get(right)));
     }
   }
 
+  /*
+    Side of the tiles of a single cluster: the VLMCs of the rows and columns
+    of a tile should fit in L2 together, and there should be about four tiles
+    per thread to balance.
+  */
   template <typename VC>
+  size_t symmetric_tile_size(cluster_container::Cluster_Container<VC>& cluster, size_t requested_cores) {
+    size_t n = cluster.size();
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i++) {
+      bytes += cluster.get(i).size() * sizeof(kmers::RI_Kmer);
+    }
+    size_t vlmc_bytes = std::max<size_t>(1, bytes / std::max<size_t>(1, n));
+    size_t cached = std::clamp<size_t>(utils::l2_cache_bytes() / (2 * vlmc_bytes), 4, 256);
+    size_t balanced = n / std::ceil(std::sqrt(8.0 * requested_cores));
+    return std::max<size_t>(1, std::min(cached, balanced));
+  }
+
+  // Pairs of the tile with right >= left, each stored on both sides of the diagonal.
+  template <typename VC, typename... Metrics>
+  void calculate_symmetric_tile(const shard::Tile& tile, distances_t& distances, cluster_container::Cluster_Container<VC>& cluster) {
+    perf::Phase_Timer timer{ perf::Phase::phase_intersection };
+    trace::Scope span{ "tile_compute", long(tile.row_start), long(tile.row_stop), long(tile.col_start), long(tile.col_stop) };
+    for (size_t left = tile.row_start; left < tile.row_stop; left++) {
+      calculate_row<VC, Metrics...>(cluster.get(left), cluster, std::max(left, tile.col_start), tile.col_stop,
+        [&](size_t right, const std::array<out_t, sizeof...(Metrics)>& values) {
+          store<Metrics...>(distances, left, right, values);
+          store<Metrics...>(distances, right, left, values);
+        });
+    }
+  }
+
+  template <typename VC, typename... Metrics>
   void calculate_full_slice(size_t start_index_left, size_t stop_index_left, size_t start_index_right, size_t stop_index_right,
-    matrix_t& distances, cluster_container::Cluster_Container<VC>& cluster_left, cluster_container::Cluster_Container<VC>& cluster_right) {
+    distances_t& distances, cluster_container::Cluster_Container<VC>& cluster_left, cluster_container::Cluster_Container<VC>& cluster_right,
+    bool block_kernel = true) {
+    perf::Phase_Timer timer{ perf::Phase::phase_intersection };
+    trace::Scope span{ "tile_compute", long(start_index_left), long(stop_index_left), long(start_index_right), long(stop_index_right) };
 
-    auto rec_fun = [&](size_t left, size_t right) {
-      distances(left, right) = distance::dvstar<VC>(cluster_left.get(left), cluster_right.get(right));
+    // The recursion runs over blocks of right VLMCs, each intersected with its left VLMC in one pass.
+    size_t block = distance::block_size;
+    size_t nr_blocks = (stop_index_right - start_index_right + block - 1) / block;
+    auto rec_fun = [&](size_t left, size_t right_block) {
+      size_t right_start = start_index_right + right_block * block;
+      calculate_row<VC, Metrics...>(cluster_left.get(left), cluster_right, right_start, std::min(right_start + block, stop_index_right),
+        [&](size_t right, const std::array<out_t, sizeof...(Metrics)>& values) { store<Metrics...>(distances, left, right, values); },
+        block_kernel);
     };
 
-    utils::matrix_recursion(start_index_left, stop_index_left, start_index_right, stop_index_right, rec_fun);
+    if (nr_blocks > 0 && stop_index_left > start_index_left) {
+      utils::matrix_recursion(start_index_left, stop_index_left, 0, nr_blocks, rec_fun);
+    }
   }
 
   //--------------------------------//
   // For inter-directory comparison //
   //--------------------------------//
-  template <typename VC>
-  matrix_t calculate_distances(cluster_container::Cluster_Container<VC>& cluster, size_t requested_cores) {
+  template <typename VC, typename... Metrics>
+  distances_t calculate_distances(cluster_container::Cluster_Container<VC>& cluster, size_t requested_cores,
+    distance::metric::metric_list<Metrics...>) {
 
-    matrix_t distances = matrix_t::Constant(cluster.size(), cluster.size(), 0);
+    distances_t distances(sizeof...(Metrics), matrix_t::Constant(cluster.size(), cluster.size(), 0));
 
-    auto fun = [&](int x1, int y1, int x2, int y2, int x3, int y3) {
-      calculate_triangle_slice<VC>(x1, y1, x2, y2, x3, y3, distances,
-        cluster, cluster);
+    // Upper triangular tiles, the diagonal tiles computed from the diagonal on.
+    auto tiles = shard::make_tiles_of_size(cluster.size(), cluster.size(), true, symmetric_tile_size(cluster, requested_cores));
+    // Costliest first, a pair costs about the contexts of both VLMCs.
+    std::vector<size_t> prefix(cluster.size() + 1, 0);
+    for (size_t i = 0; i < cluster.size(); i++) {
+      prefix[i + 1] = prefix[i] + cluster.get(i).size();
+    }
+    auto cost = [&](const shard::Tile& tile) {
+      return (prefix[tile.row_stop] - prefix[tile.row_start]) * tile.cols() + (prefix[tile.col_stop] - prefix[tile.col_start]) * tile.rows();
+    };
+    std::stable_sort(tiles.begin(), tiles.end(), [&](const shard::Tile& a, const shard::Tile& b) { return cost(a) > cost(b); });
+    std::vector<size_t> node_of_tile(tiles.size());
+    for (size_t t = 0; t < tiles.size(); t++) {
+      node_of_tile[t] = numa::node_of_index(tiles[t].row_start, cluster.size());
+    }
+    auto fun = [&](size_t t) {
+      calculate_symmetric_tile<VC, Metrics...>(tiles[t], distances, cluster);
     };
 
-    parallel::parallelize_triangle(cluster.size(), fun, requested_cores);
+    parallel::parallelize_dynamic(node_of_tile, fun, requested_cores);
     return distances;
   }
 
   //-------------------------------//
   // For comparing two directories //
   //-------------------------------//
-  template <typename VC>
-  matrix_t calculate_distances(
+  template <typename VC, typename... Metrics>
+  distances_t calculate_distances(
     cluster_container::Cluster_Container<VC>& cluster_left,
-    cluster_container::Cluster_Container<VC>& cluster_right, size_t requested_cores) {
+    cluster_container::Cluster_Container<VC>& cluster_right, size_t requested_cores,
+    distance::metric::metric_list<Metrics...>, bool block_kernel = true) {
 
-    matrix_t distances{ cluster_left.size(), cluster_right.size() };
+    distances_t distances(sizeof...(Metrics), matrix_t{ cluster_left.size(), cluster_right.size() });
 
     auto fun = [&](size_t start_index_left, size_t stop_index_left, size_t start_index_right, size_t stop_index_right) {
-      calculate_full_slice<VC>(start_index_left, stop_index_left, start_index_right, stop_index_right, std::ref(distances),
-        std::ref(cluster_left), std::ref(cluster_right));
+      calculate_full_slice<VC, Metrics...>(start_index_left, stop_index_left, start_index_right, stop_index_right, std::ref(distances),
+        std::ref(cluster_left), std::ref(cluster_right), block_kernel);
     };
 
     parallel::parallelize(cluster_left.size(), cluster_right.size(), fun, requested_cores);
     return distances;
   }
 
+  //-------------------------------------//
+  // For one shard of a split comparison //
+  //-------------------------------------//
+  /*
+    Distances of each tile, indexed from the corner of the tile. In triangle
+    mode only right >= left is computed, like calculate_distances for a single
+    cluster. The tiles are the same in every shard, so the work of the threads
+    is sized separately: the rows of the tiles are cut into about four pieces
+    per thread.
+  */
+  template <typename VC, typename... Metrics>
+  std::vector<distances_t> calculate_tiles(const std::vector<shard::Tile>& tiles, bool triangle,
+    cluster_container::Cluster_Container<VC>& cluster_left, cluster_container::Cluster_Container<VC>& cluster_right,
+    size_t requested_cores, distance::metric::metric_list<Metrics...>) {
+    std::vector<distances_t> tile_distances(tiles.size());
+    size_t nr_rows = 0;
+    for (size_t t = 0; t < tiles.size(); t++) {
+      tile_distances[t] = distances_t(sizeof...(Metrics), matrix_t::Zero(tiles[t].rows(), tiles[t].cols()));
+      nr_rows += tiles[t].rows();
+    }
+
+    // Pieces of (tile, first row, last row), the rows of a piece are written by its thread only.
+    size_t nr_pieces = 4 * std::max<size_t>(1, requested_cores);
+    size_t piece_rows = std::max<size_t>(1, (nr_rows + nr_pieces - 1) / nr_pieces);
+    std::vector<std::array<size_t, 3>> pieces{};
+    for (size_t t = 0; t < tiles.size(); t++) {
+      for (size_t row = tiles[t].row_start; row < tiles[t].row_stop; row += piece_rows) {
+        pieces.push_back({ t, row, std::min(row + piece_rows, tiles[t].row_stop) });
+      }
+    }
+
+    auto fun = [&](size_t start_index, size_t stop_index) {
+      for (size_t p = start_index; p < stop_index; p++) {
+        auto [t, row_start, row_stop] = pieces[p];
+        auto& tile = tiles[t];
+        auto& distances = tile_distances[t];
+        perf::Phase_Timer timer{ perf::Phase::phase_intersection };
+        trace::Scope span{ "tile_compute", long(row_start), long(row_stop), long(tile.col_start), long(tile.col_stop) };
+
+        for (size_t left = row_start; left < row_stop; left++) {
+          calculate_row<VC, Metrics...>(cluster_left.get(left), cluster_right, triangle ? std::max(left, tile.col_start) : tile.col_start,
+            tile.col_stop, [&](size_t right, const std::array<out_t, sizeof...(Metrics)>& values) {
+              store<Metrics...>(distances, left - tile.row_start, right - tile.col_start, values);
+            });
+        }
+      }
+    };
+
+    parallel::parallelize(pieces.size(), fun, requested_cores);
+    return tile_distances;
+  }
+
+  template <typename VC>
+  matrix_t calculate_distances(cluster_container::Cluster_Container<VC>& cluster, size_t requested_cores) {
+    return calculate_distances<VC>(cluster, requested_cores, distance::metric::metric_list<distance::metric::Dvstar>{})[0];
+  }
+
+  template <typename VC>
+  matrix_t calculate_distances(
+    cluster_container::Cluster_Container<VC>& cluster_left,
+    cluster_container::Cluster_Container<VC>& cluster_right, size_t requested_cores) {
+    return calculate_distances<VC>(cluster_left, cluster_right, requested_cores,
+      distance::metric::metric_list<distance::metric::Dvstar>{})[0];
+  }
+
+  template <typename... Metrics>
   void calculate_kmer_buckets(
     cluster_container::Kmer_Cluster& cluster_left, cluster_container::Kmer_Cluster& cluster_right,
-    int left_offset, int right_offset, matrix_t& distances) {
-    matrix_t dot_prod = matrix_t::Zero(cluster_left.size(), cluster_right.size());
-    matrix_t left_norm = matrix_t::Zero(cluster_left.size(), cluster_right.size());
-    matrix_t right_norm = matrix_t::Zero(cluster_left.size(), cluster_right.size());
+    int left_offset, int right_offset, distances_t& distances) {
+    perf::Phase_Timer timer{ perf::Phase::phase_intersection };
+    trace::Scope span{ "tile_compute", left_offset, left_offset + cluster_left.size(), right_offset, right_offset + cluster_right.size() };
+    std::vector<distance::accumulator_tuple_t<Metrics...>> accumulators(cluster_left.size() * cluster_right.size());
+    std::vector<size_t> matched(accumulators.size(), 0);
 
     auto left_it = cluster_left.get_begin();
     auto left_end = cluster_left.get_end();
@@ -103,24 +264,30 @@ namespace calc_dist {
       auto idx = left_it->first;
       auto right_it = cluster_right.find(idx);
       if (right_it != cluster_right.get_end()) {
-        distance::dvstar_kmer_major(left_it->second, right_it->second, dot_prod, left_norm, right_norm);
+        distance::kmer_major<Metrics...>(left_it->second, right_it->second, accumulators, matched, cluster_right.size());
       }
       left_it++;
     }
 
-    for (int x = 0; x < dot_prod.rows(); x++) {
-      for (int y = 0; y < dot_prod.cols(); y++) {
-        distances(x + left_offset, y + right_offset) = distance::normalise_dvstar(dot_prod(x, y), left_norm(x, y), right_norm(x, y));
+    for (int x = 0; x < cluster_left.size(); x++) {
+      for (int y = 0; y < cluster_right.size(); y++) {
+        auto values = distance::metric::finalise_all<Metrics...>(accumulators[x * cluster_right.size() + y],
+          { cluster_left.squared_norm(x), cluster_right.squared_norm(y), cluster_left.nr_kmers(x), cluster_right.nr_kmers(y),
+            matched[x * cluster_right.size() + y] });
+        store<Metrics...>(distances, x + left_offset, y + right_offset, values);
       }
     }
+    perf::count(perf::Counter::pairs_computed, cluster_left.size() * cluster_right.size());
   }
 
   //---------------------------//
   // Kmer-major implementation //
   //---------------------------//
-  matrix_t calculate_distance_major(
+  template <typename... Metrics>
+  distances_t calculate_distance_major(
     std::vector<cluster_container::Kmer_Cluster>& cluster_left,
-    std::vector<cluster_container::Kmer_Cluster>& cluster_right, size_t nr_cores_to_use) {
+    std::vector<cluster_container::Kmer_Cluster>& cluster_right, size_t nr_cores_to_use,
+    distance::metric::metric_list<Metrics...>) {
 
     auto cluster_left_size = 0;
     std::vector<int> cluster_left_offsets{};
@@ -136,12 +303,12 @@ namespace calc_dist {
       cluster_right_size += cluster_right[i].size();
     }
 
-    matrix_t distances = matrix_t::Zero(cluster_left_size, cluster_right_size);
+    distances_t distances(sizeof...(Metrics), matrix_t::Zero(cluster_left_size, cluster_right_size));
 
     auto fun = [&](size_t start_index_left, size_t stop_index_left, size_t start_index_right, size_t stop_index_right) {
       for (auto left_i = start_index_left; left_i < stop_index_left; left_i++) {
         for (auto right_i = start_index_right; right_i < stop_index_right; right_i++) {
-          calculate_kmer_buckets(cluster_left[left_i], cluster_right[right_i], cluster_left_offsets[left_i], cluster_right_offsets[right_i], distances);
+          calculate_kmer_buckets<Metrics...>(cluster_left[left_i], cluster_right[right_i], cluster_left_offsets[left_i], cluster_right_offsets[right_i], distances);
         }
       }
     };
@@ -150,4 +317,220 @@ namespace calc_dist {
 
     return distances;
   }
-}
\ No newline at end of file
+
+  matrix_t calculate_distance_major(
+    std::vector<cluster_container::Kmer_Cluster>& cluster_left,
+    std::vector<cluster_container::Kmer_Cluster>& cluster_right, size_t nr_cores_to_use) {
+    return calculate_distance_major(cluster_left, cluster_right, nr_cores_to_use,
+      distance::metric::metric_list<distance::metric::Dvstar>{})[0];
+  }
+
+  //----------------------------//
+  // Key-partitioned kmer-major //
+  //----------------------------//
+  // Total bytes of the thread-local accumulators, larger comparisons are done in blocks of rows.
+  constexpr size_t partition_memory_budget = size_t(1) << 30;
+
+  struct Partition_Entry {
+    int key;
+    uint32_t id;
+    acc_t norm;
+    const kmers::RI_Kmer* kmer;
+  };
+
+  // Key bounds that split the contexts of the clusters into nr_partitions ranges of about equal size.
+  std::vector<int64_t> partition_bounds(const std::vector<cluster_container::Cluster_Container<vlmc_container::VLMC_sorted_vector>*>& clusters,
+    size_t nr_partitions) {
+    std::vector<int> keys{};
+    for (auto* cluster : clusters) {
+      for (size_t i = 0; i < cluster->size(); i++) {
+        for (auto& kmer : cluster->get(i).container) {
+          keys.push_back(kmer.integer_rep);
+        }
+      }
+    }
+    std::vector<int64_t> bounds{ std::numeric_limits<int64_t>::min() };
+    for (size_t p = 1; p < nr_partitions && !keys.empty(); p++) {
+      auto nth = keys.begin() + p * keys.size() / nr_partitions;
+      std::nth_element(keys.begin(), nth, keys.end());
+      bounds.push_back(*nth);
+    }
+    bounds.push_back(std::numeric_limits<int64_t>::max());
+    return bounds;
+  }
+
+  // The contexts of VLMCs [start, stop) with keys in [low, high), sorted by key and then VLMC.
+  std::vector<Partition_Entry> partition_entries(cluster_container::Cluster_Container<vlmc_container::VLMC_sorted_vector>& cluster,
+    size_t start, size_t stop, int64_t low, int64_t high) {
+    std::vector<Partition_Entry> entries{};
+    for (size_t i = start; i < stop; i++) {
+      auto& kmers = cluster.get(i).container;
+      auto it = std::lower_bound(kmers.begin(), kmers.end(), low,
+        [](const kmers::RI_Kmer& kmer, int64_t key) { return kmer.integer_rep < key; });
+      for (; it != kmers.end() && it->integer_rep < high; ++it) {
+        entries.push_back({ it->integer_rep, uint32_t(i), distance::dot(*it, *it), &*it });
+      }
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const Partition_Entry& a, const Partition_Entry& b) { return a.key < b.key; });
+    return entries;
+  }
+
+  /*
+    Kmer-major over a range partition of the context keys instead of over
+    groups of VLMCs: every thread walks the contexts of its key range in all
+    VLMCs and adds the dot products and norms of the matched contexts to its
+    own accumulators for the result, which are then summed and finalised in
+    parallel. The parallelism is the number of threads, whatever the number
+    of VLMCs. With symmetric the clusters are the same and only right >= left
+    is accumulated.
+  */
+  template <typename... Metrics>
+  distances_t calculate_partitioned(cluster_container::Cluster_Container<vlmc_container::VLMC_sorted_vector>& cluster_left,
+    cluster_container::Cluster_Container<vlmc_container::VLMC_sorted_vector>& cluster_right, bool symmetric,
+    size_t requested_cores, distance::metric::metric_list<Metrics...>) {
+    // The sums and the number of contexts of a pair that were matched in a partition.
+    struct accumulator_t : distance::metric::Dot_norm_accumulator {
+      size_t matched = 0;
+    };
+    size_t rows = cluster_left.size();
+    size_t cols = cluster_right.size();
+    distances_t distances(sizeof...(Metrics), matrix_t::Zero(rows, cols));
+    if (rows == 0 || cols == 0) {
+      return distances;
+    }
+
+    size_t nr_threads = utils::get_used_cores(requested_cores, std::numeric_limits<size_t>::max());
+    std::vector<cluster_container::Cluster_Container<vlmc_container::VLMC_sorted_vector>*> clusters{ &cluster_left };
+    if (!symmetric) {
+      clusters.push_back(&cluster_right);
+    }
+    auto bounds = partition_bounds(clusters, nr_threads);
+    size_t nr_partitions = bounds.size() - 1;
+    size_t block_rows = std::clamp<size_t>(partition_memory_budget / (nr_partitions * cols * sizeof(accumulator_t)), 1, rows);
+    std::vector<std::vector<accumulator_t>> accumulators(nr_partitions);
+
+    for (size_t row_start = 0; row_start < rows; row_start += block_rows) {
+      size_t row_stop = std::min(rows, row_start + block_rows);
+      size_t block_size = (row_stop - row_start) * cols;
+
+      // One partition per thread, so the index of the partition is also the thread's.
+      auto accumulate = [&](size_t start_index, size_t stop_index) {
+        for (size_t p = start_index; p < stop_index; p++) {
+          perf::Phase_Timer timer{ perf::Phase::phase_intersection };
+          trace::Scope span{ "partition_accumulate", long(p), long(row_start), long(row_stop) };
+          auto& acc = accumulators[p];
+          acc.assign(block_size, accumulator_t{});
+          auto left = partition_entries(cluster_left, row_start, row_stop, bounds[p], bounds[p + 1]);
+          auto right = partition_entries(cluster_right, 0, cols, bounds[p], bounds[p + 1]);
+
+          unsigned long matched = 0;
+          auto right_it = right.begin();
+          for (auto left_it = left.begin(); left_it != left.end();) {
+            auto left_end = std::find_if(left_it, left.end(), [&](const Partition_Entry& e) { return e.key != left_it->key; });
+            while (right_it != right.end() && right_it->key < left_it->key) {
+              ++right_it;
+            }
+            auto right_end = std::find_if(right_it, right.end(), [&](const Partition_Entry& e) { return e.key != left_it->key; });
+            for (auto l = left_it; l != left_end; ++l) {
+              auto* row = acc.data() + (l->id - row_start) * cols;
+              // Within a key the entries are ordered by VLMC.
+              auto r = symmetric ? std::partition_point(right_it, right_end, [&](const Partition_Entry& e) { return e.id < l->id; }) : right_it;
+              matched += right_end - r;
+              for (; r != right_end; ++r) {
+                auto& a = row[r->id];
+                a.dot_product += distance::dot(*l->kmer, *r->kmer);
+                a.left_norm += l->norm;
+                a.right_norm += r->norm;
+                a.matched++;
+              }
+            }
+            left_it = left_end;
+            right_it = right_end;
+          }
+          perf::count(perf::Counter::matched_contexts, matched);
+        }
+      };
+      parallel::parallelize(nr_partitions, accumulate, nr_threads);
+
+      auto reduce = [&](size_t start_index, size_t stop_index) {
+        perf::Phase_Timer timer{ perf::Phase::phase_intersection };
+        trace::Scope span{ "partition_reduce", long(row_start + start_index), long(row_start + stop_index) };
+        for (size_t i = start_index; i < stop_index; i++) {
+          size_t row = row_start + i;
+          for (size_t col = symmetric ? row : 0; col < cols; col++) {
+            accumulator_t sum{};
+            for (auto& acc : accumulators) {
+              auto& a = acc[i * cols + col];
+              sum.dot_product += a.dot_product;
+              sum.left_norm += a.left_norm;
+              sum.right_norm += a.right_norm;
+              sum.matched += a.matched;
+            }
+            auto& left = cluster_left.get(row);
+            auto& right = cluster_right.get(col);
+            distance::metric::Norms norms{ left.squared_norm, right.squared_norm, left.size(), right.size(), sum.matched };
+            std::array<out_t, sizeof...(Metrics)> values{ distance::metric::finalise_from_dot_norm<Metrics>(sum, norms)... };
+            store<Metrics...>(distances, row, col, values);
+            if (symmetric) {
+              store<Metrics...>(distances, col, row, values);
+            }
+          }
+          perf::count(perf::Counter::pairs_computed, symmetric ? cols - row : cols);
+        }
+      };
+      parallel::parallelize(row_stop - row_start, reduce, nr_threads);
+    }
+    return distances;
+  }
+
+  template <typename... Metrics>
+  distances_t calculate_partitioned(cluster_container::Cluster_Container<vlmc_container::VLMC_sorted_vector>& cluster,
+    size_t requested_cores, distance::metric::metric_list<Metrics...> metrics) {
+    return calculate_partitioned(cluster, cluster, true, requested_cores, metrics);
+  }
+
+  //-------------------------------//
+  // One-vs-many with query tables //
+  //-------------------------------//
+  /*
+    The queries are taken one at a time: a query VLMC is expanded into a
+    query table, which the threads share while each streams the keys of its
+    part of the references through it. Only one table is alive at a time.
+    With symmetric the clusters are the same and only the references from the
+    query on are compared, the rest is mirrored.
+  */
+  template <typename... Metrics>
+  distances_t calculate_query_tables(cluster_container::Cluster_Container<vlmc_container::VLMC_sorted_vector>& cluster_queries,
+    cluster_container::Cluster_Container<vlmc_container::VLMC_sorted_vector>& cluster_references, bool symmetric,
+    size_t requested_cores, distance::metric::metric_list<Metrics...>) {
+    distances_t distances(sizeof...(Metrics), matrix_t{ cluster_queries.size(), cluster_references.size() });
+
+    for (size_t i = 0; i < cluster_queries.size(); i++) {
+      auto& query = cluster_queries.get(i);
+      query_table::Query_Table table{};
+      {
+        perf::Phase_Timer timer{ perf::Phase::phase_layout };
+        table = query_table::Query_Table(query.container);
+      }
+      size_t first = symmetric ? i : 0;
+      parallel::parallelize(cluster_references.size() - first, [&](size_t start, size_t stop) {
+        perf::Phase_Timer timer{ perf::Phase::phase_intersection };
+        trace::Scope span{ "tile_compute", long(i), long(i + 1), long(first + start), long(first + stop) };
+        for (size_t j = first + start; j < first + stop; j++) {
+          auto values = distance::fused_query<Metrics...>(table, query.squared_norm, cluster_references.get(j));
+          store<Metrics...>(distances, i, j, values);
+          if (symmetric) {
+            store<Metrics...>(distances, j, i, values);
+          }
+        }
+      }, requested_cores);
+    }
+    return distances;
+  }
+
+  template <typename... Metrics>
+  distances_t calculate_query_tables(cluster_container::Cluster_Container<vlmc_container::VLMC_sorted_vector>& cluster,
+    size_t requested_cores, distance::metric::metric_list<Metrics...> metrics) {
+    return calculate_query_tables(cluster, cluster, true, requested_cores, metrics);
+  }
+}
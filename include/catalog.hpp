@@ -0,0 +1,145 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+#include <unordered_map>
+
+#include "kmer.hpp"
+#include "read_in_kmer.hpp"
+#include "parallel.hpp"
+
+/*
+  Index of a collection of VLMCs for the 'catalog' subcommand. Every VLMC has
+  one tab separated line with its path, file size, modification time and
+  number of k-mers. Given instead of a directory it replaces the directory
+  scan, and the k-mer counts size the arena and order the loading before any
+  file is read.
+*/
+namespace catalog {
+  constexpr const char* header = "# dvstar catalog 2";
+
+  struct Entry {
+    std::filesystem::path path{};
+    uintmax_t file_size = 0;
+    int64_t modified = 0;
+    size_t nr_kmers = 0;
+  };
+
+  struct Catalog {
+    // Sorted by path.
+    std::vector<Entry> entries{};
+  };
+
+  int64_t modified_time(const std::filesystem::path& path) {
+    return std::filesystem::last_write_time(path).time_since_epoch().count();
+  }
+
+  // Whether the file of entry still has the size and modification time it was cataloged with.
+  bool is_current(const Entry& entry) {
+    std::error_code error{};
+    auto file_size = std::filesystem::file_size(entry.path, error);
+    if (error || file_size != entry.file_size) {
+      return false;
+    }
+    auto modified = std::filesystem::last_write_time(entry.path, error);
+    return !error && modified.time_since_epoch().count() == entry.modified;
+  }
+
+  Entry scan_file(const std::filesystem::path& path) {
+    Entry entry{ path, std::filesystem::file_size(path), modified_time(path) };
+    std::ifstream ifs(path, std::ios::binary);
+    cereal::BinaryInputArchive archive(ifs);
+    kmers::VLMCKmer input_kmer{};
+    while (ifs.peek() != EOF) {
+      archive(input_kmer);
+      entry.nr_kmers++;
+    }
+    return entry;
+  }
+
+  /*
+    Catalogs the regular files under directory. Files whose entry in previous
+    is still current keep that entry without being read.
+  */
+  Catalog build(const std::filesystem::path& directory, size_t nr_cores, const Catalog& previous, size_t& nr_unchanged) {
+    Catalog catalog{};
+    for (const auto& dir_entry : std::filesystem::recursive_directory_iterator(directory)) {
+      if (dir_entry.is_regular_file()) {
+        catalog.entries.push_back({ std::filesystem::absolute(dir_entry.path()) });
+      }
+    }
+    std::sort(catalog.entries.begin(), catalog.entries.end(), [](const Entry& a, const Entry& b) { return a.path < b.path; });
+
+    std::unordered_map<std::string, const Entry*> known{};
+    for (auto& entry : previous.entries) {
+      known[entry.path.string()] = &entry;
+    }
+    std::vector<bool> unchanged(catalog.entries.size(), false);
+    auto fun = [&](size_t start_index, size_t stop_index) {
+      for (size_t i = start_index; i < stop_index; i++) {
+        auto& path = catalog.entries[i].path;
+        auto it = known.find(path.string());
+        if (it != known.end() && is_current(*it->second)) {
+          catalog.entries[i] = *it->second;
+          unchanged[i] = true;
+        }
+        else {
+          catalog.entries[i] = scan_file(path);
+        }
+      }
+    };
+    parallel::parallelize(catalog.entries.size(), fun, nr_cores);
+    nr_unchanged = std::count(unchanged.begin(), unchanged.end(), true);
+    return catalog;
+  }
+
+  void write(const std::filesystem::path& path, const Catalog& catalog) {
+    std::ofstream os{ path };
+    os << header << "\n";
+    os << "# path\tfile_size\tmodified\tnr_kmers\n";
+    for (auto& entry : catalog.entries) {
+      os << entry.path.string() << "\t" << entry.file_size << "\t" << entry.modified << "\t" << entry.nr_kmers << "\n";
+    }
+  }
+
+  // A catalog is a regular file starting with the header, collections are directories.
+  bool is_catalog(const std::filesystem::path& path) {
+    if (!std::filesystem::is_regular_file(path)) {
+      return false;
+    }
+    std::ifstream is{ path };
+    std::string line{};
+    std::getline(is, line);
+    return line == header;
+  }
+
+  Catalog read(const std::filesystem::path& path) {
+    if (!is_catalog(path)) {
+      throw std::runtime_error(path.string() + " is not a catalog.");
+    }
+    Catalog catalog{};
+    std::ifstream is{ path };
+    std::string line{};
+    while (std::getline(is, line)) {
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+      std::vector<std::string> fields{};
+      std::istringstream ls{ line };
+      for (std::string field; std::getline(ls, field, '\t');) {
+        fields.push_back(field);
+      }
+      if (fields.size() != 4) {
+        throw std::runtime_error("Malformed line in catalog " + path.string() + ": " + line);
+      }
+      catalog.entries.push_back({ fields[0], std::stoull(fields[1]), std::stoll(fields[2]), std::stoull(fields[3]) });
+    }
+    return catalog;
+  }
+}
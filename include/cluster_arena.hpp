@@ -0,0 +1,150 @@
+#pragma once
+
+#include <new>
+#include <mutex>
+#include <vector>
+#include <filesystem>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "numa.hpp"
+#include "read_in_kmer.hpp"
+#include "bundle.hpp"
+
+/*
+  Bump allocator for the layouts of a whole cluster of VLMCs. The memory is
+  reserved up front in one mapping, backed by transparent huge pages where the
+  kernel allows it, and only released when the arena is destroyed. If the
+  estimate was too small another chunk is mapped, so the number of
+  allocations is the number of chunks rather than the number of VLMCs. In the
+  NUMA mode every node has its own chunks and threads allocate from the node
+  they are pinned to.
+*/
+namespace cluster_arena {
+  constexpr size_t alignment = 64;
+  constexpr size_t huge_page_size = 2 << 20;
+
+  class Arena {
+  private:
+    struct Chunk {
+      char* data;
+      size_t capacity;
+      size_t used;
+    };
+
+    std::mutex mutex{};
+    // Chunks of each node.
+    std::vector<std::vector<Chunk>> chunks{};
+    size_t chunk_size;
+
+    static char* map(size_t bytes, size_t node) {
+#if defined(__linux__)
+      void* data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (data == MAP_FAILED) {
+        throw std::bad_alloc{};
+      }
+#if defined(MADV_HUGEPAGE)
+      madvise(data, bytes, MADV_HUGEPAGE);
+#endif
+      numa::bind_memory(data, bytes, node);
+      return static_cast<char*>(data);
+#else
+      return static_cast<char*>(::operator new(bytes, std::align_val_t(alignment)));
+#endif
+    }
+
+    static void unmap(const Chunk& chunk) {
+#if defined(__linux__)
+      munmap(chunk.data, chunk.capacity);
+#else
+      ::operator delete(chunk.data, std::align_val_t(alignment));
+#endif
+    }
+
+    static size_t round_up(size_t bytes, size_t to) { return (bytes + to - 1) / to * to; }
+
+  public:
+    Arena(size_t capacity, size_t nr_nodes = 1)
+      : chunks(nr_nodes), chunk_size(round_up(std::max(capacity / nr_nodes, size_t(1)), huge_page_size)) {
+      for (size_t node = 0; node < nr_nodes; node++) {
+        chunks[node].push_back({ map(chunk_size, node), chunk_size, 0 });
+      }
+    }
+
+    ~Arena() {
+      for (auto& node_chunks : chunks) {
+        for (auto& chunk : node_chunks) {
+          unmap(chunk);
+        }
+      }
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Cache line aligned, uninitialised storage for n trivially copyable T.
+    template <typename T>
+    T* allocate(size_t n) {
+      size_t bytes = round_up(std::max(n * sizeof(T), size_t(1)), alignment);
+      size_t node = numa::current_node() % chunks.size();
+      std::lock_guard<std::mutex> lock{ mutex };
+      auto* chunk = &chunks[node].back();
+      if (chunk->used + bytes > chunk->capacity) {
+        size_t capacity = round_up(std::max(bytes, chunk_size / 4), huge_page_size);
+        chunks[node].push_back({ map(capacity, node), capacity, 0 });
+        chunk = &chunks[node].back();
+      }
+      T* data = reinterpret_cast<T*>(chunk->data + chunk->used);
+      chunk->used += bytes;
+      return data;
+    }
+
+    size_t nr_chunks() const {
+      size_t nr = 0;
+      for (auto& node_chunks : chunks) {
+        nr += node_chunks.size();
+      }
+      return nr;
+    }
+
+    size_t bytes_used() const {
+      size_t used = 0;
+      for (auto& node_chunks : chunks) {
+        for (auto& chunk : node_chunks) {
+          used += chunk.used;
+        }
+      }
+      return used;
+    }
+  };
+
+  /*
+    The serialised contexts take more space than their layouts, so the file
+    sizes bound the arena. Pages are only backed once written, so the
+    overestimate costs address space but not memory.
+  */
+  size_t estimate_capacity(const std::vector<std::filesystem::path>& paths, size_t nr_paths) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < nr_paths; i++) {
+      if (auto member = bundle::find_member(paths[i])) {
+        bytes += member->size() + 4 * alignment;
+        continue;
+      }
+      std::error_code ec;
+      auto file_size = std::filesystem::file_size(paths[i], ec);
+      bytes += (ec ? 0 : file_size) + 4 * alignment;
+    }
+    return bytes;
+  }
+
+  // From the k-mer counts of a catalog: the largest layouts hold a kmer and two keys per context.
+  size_t estimate_capacity(const std::vector<size_t>& nr_kmers) {
+    size_t bytes = 0;
+    for (auto n : nr_kmers) {
+      bytes += (n + 1) * (sizeof(kmers::RI_Kmer) + 2 * sizeof(int)) + 4 * alignment;
+    }
+    return bytes;
+  }
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <functional>
 #include <filesystem>
 #include <unordered_map>
@@ -12,6 +13,8 @@ namespace cluster_container {
 
   private:
     std::vector<VC> container{};
+    // Backs the VLMCs that are views, shared so that copies of the cluster stay valid.
+    std::shared_ptr<cluster_arena::Arena> arena{};
 
   public:
     Cluster_Container() = default;
@@ -19,12 +22,16 @@ namespace cluster_container {
 
     Cluster_Container(const size_t i) : container(i) {}
 
+    Cluster_Container(const size_t i, std::shared_ptr<cluster_arena::Arena> arena) : container(i), arena(std::move(arena)) {}
+
     size_t size() const { return container.size(); }
 
     void push(const VC vlmc) { container.push_back(vlmc); }
 
     VC& get(const int i) { return container[i]; }
 
+    const std::shared_ptr<cluster_arena::Arena>& get_arena() const { return arena; }
+
     VC& operator[](size_t index) { return container[index]; }
 
     const VC& operator[](size_t index) const { return container[index]; }
@@ -49,6 +56,9 @@ namespace cluster_container {
     std::unordered_map<int, std::vector<Kmer_Pair>> container{};
 
     size_t vlmc_count = 0;
+    // Squared norm and number of all kmers of each VLMC, by id.
+    std::vector<acc_t> norms{};
+    std::vector<size_t> sizes{};
 
   public:
     Kmer_Cluster() = default;
@@ -60,6 +70,14 @@ namespace cluster_container {
 
     void push(const Kmer_Pair kmer_pair) {
       container[kmer_pair.kmer.integer_rep].push_back(kmer_pair);
+      if (kmer_pair.id >= norms.size()) {
+        norms.resize(kmer_pair.id + 1, 0.0);
+        sizes.resize(kmer_pair.id + 1, 0);
+      }
+      sizes[kmer_pair.id]++;
+      for (int x = 0; x < 4; x++) {
+        norms[kmer_pair.id] += acc_t(kmer_pair.kmer.next_char_prob[x]) * kmer_pair.kmer.next_char_prob[x];
+      }
     }
 
     void push_all(Kmer_Cluster cluster) {
@@ -69,8 +87,22 @@ namespace cluster_container {
         container[begin_it->first].insert(container[begin_it->first].end(), begin_it->second.begin(), begin_it->second.end());
         begin_it++;
       }
+      if (cluster.norms.size() > norms.size()) {
+        norms.resize(cluster.norms.size(), 0.0);
+        sizes.resize(cluster.norms.size(), 0);
+      }
+      for (size_t id = 0; id < cluster.norms.size(); id++) {
+        norms[id] += cluster.norms[id];
+        sizes[id] += cluster.sizes[id];
+      }
     }
 
+    // 0 for a VLMC without kmers.
+    acc_t squared_norm(size_t id) const { return id < norms.size() ? norms[id] : 0.0; }
+
+    // Number of kmers of a VLMC, 0 for one without kmers.
+    size_t nr_kmers(size_t id) const { return id < sizes.size() ? sizes[id] : 0; }
+
     std::vector<Kmer_Pair>& get(int bucket_num) {
       return container[bucket_num];
     }
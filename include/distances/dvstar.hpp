@@ -1,11 +1,15 @@
 #pragma once
 
 #include <math.h>
+#include <limits>
 
+#include "metrics.hpp"
 #include "vlmc_container.hpp"
 #include "cluster_container.hpp"
 #include "read_in_kmer.hpp"
+#include "query_table.hpp"
 #include "utils.hpp"
+#include "perf_report.hpp"
 #include "global_aliases.hpp"
 
 namespace distance {
@@ -13,80 +17,169 @@ namespace distance {
   using bucket_t = std::vector<cluster_container::Kmer_Pair>;
   using RI_Kmer = kmers::RI_Kmer;
 
-  out_t normalise_dvstar(out_t dot_product, out_t left_norm, out_t right_norm) {
+  /*
+    Integer dot product and norms of two quantized VLMCs, scaled back to
+    doubles once per pair. Every metric is finalised from those three sums.
+  */
+  template <typename VC, typename... Metrics>
+  std::array<out_t, sizeof...(Metrics)> fused_quantized(VC& left, VC& right) {
+    unsigned long matched = 0;
+    auto acc = vlmc_container::quantized_dot_norm(left, right, matched);
+    perf::count(perf::Counter::matched_contexts, matched);
+    perf::count(perf::Counter::pairs_computed);
 
-    left_norm = std::sqrt(left_norm);
-    right_norm = std::sqrt(right_norm);
-    if (left_norm == 0 || right_norm == 0) {
-      return 1.0;
+    metric::Dot_norm_accumulator scaled{
+      acc_t(acc.dot_product * left.arr.scale * right.arr.scale),
+      acc_t(acc.left_norm * left.arr.scale * left.arr.scale),
+      acc_t(acc.right_norm * right.arr.scale * right.arr.scale) };
+    metric::Norms norms{ left.squared_norm, right.squared_norm, left.size(), right.size(), matched };
+    return { metric::finalise_from_dot_norm<Metrics>(scaled, norms)... };
+  }
+
+  /*
+    Computes every metric in Metrics in a single intersection of left and right.
+    Accumulators live in a tuple on the stack and the callback is inlined into
+    iterate_kmers, so no state escapes to memory per pair.
+  */
+  template <typename VC, typename... Metrics>
+  std::array<out_t, sizeof...(Metrics)> fused(VC& left, VC& right) {
+    if constexpr (vlmc_container::is_quantized<VC>) {
+      return fused_quantized<VC, Metrics...>(left, right);
     }
     else {
-      out_t Dvstar = dot_product / (left_norm * right_norm);
+      std::tuple<typename Metrics::accumulator_t...> accumulators{};
+      unsigned long matched = 0;
 
-      out_t dvstar = 0.5 * (1 - Dvstar);
+      auto f = [&](const RI_Kmer& left_kmer, const RI_Kmer& right_kmer) {
+        matched++;
+        std::apply([&](auto&... acc) { (Metrics::accumulate(acc, left_kmer, right_kmer), ...); }, accumulators);
+      };
+      auto swapped_f = [&](const RI_Kmer& right_kmer, const RI_Kmer& left_kmer) { f(left_kmer, right_kmer); };
 
-      out_t angular_distance = 2 * std::acos(Dvstar) / M_PI;
-      if (isnan(angular_distance)) {
-        return 0.0;
+      if (left.size() < right.size()) {
+        vlmc_container::iterate_kmers(left, right, f);
       }
       else {
-        return angular_distance;
+        vlmc_container::iterate_kmers(right, left, swapped_f);
       }
+      perf::count(perf::Counter::matched_contexts, matched);
+      perf::count(perf::Counter::pairs_computed);
+
+      return metric::finalise_all<Metrics...>(accumulators, { left.squared_norm, right.squared_norm, left.size(), right.size(), matched });
     }
   }
 
-  template <typename VC>
-  out_t dvstar(VC& left, VC& right) {
-    out_t dot_product = 0.0;
-    out_t left_norm = 0.0;
-    out_t right_norm = 0.0;
-
-    auto f = [&](const RI_Kmer& left_kmer, const RI_Kmer& right_kmer) {
-      dot_product += ((left_kmer.next_char_prob[0] * right_kmer.next_char_prob[0]) +
-        (left_kmer.next_char_prob[1] * right_kmer.next_char_prob[1]) +
-        (left_kmer.next_char_prob[2] * right_kmer.next_char_prob[2]) +
-        (left_kmer.next_char_prob[3] * right_kmer.next_char_prob[3]));
-      left_norm += ((left_kmer.next_char_prob[0] * left_kmer.next_char_prob[0]) +
-        (left_kmer.next_char_prob[1] * left_kmer.next_char_prob[1]) +
-        (left_kmer.next_char_prob[2] * left_kmer.next_char_prob[2]) +
-        (left_kmer.next_char_prob[3] * left_kmer.next_char_prob[3]));
-      right_norm += ((right_kmer.next_char_prob[0] * right_kmer.next_char_prob[0]) +
-        (right_kmer.next_char_prob[1] * right_kmer.next_char_prob[1]) +
-        (right_kmer.next_char_prob[2] * right_kmer.next_char_prob[2]) +
-        (right_kmer.next_char_prob[3] * right_kmer.next_char_prob[3]));
+  // Every metric of a query against one reference, whose keys are looked up in the table of the query.
+  template <typename... Metrics>
+  std::array<out_t, sizeof...(Metrics)> fused_query(const query_table::Query_Table& query, acc_t query_norm,
+    vlmc_container::VLMC_sorted_vector& reference) {
+    std::tuple<typename Metrics::accumulator_t...> accumulators{};
+    unsigned long matched = 0;
+
+    query.probe(reference.container.data(), reference.size(), [&](int query_i, int reference_i) {
+      matched++;
+      std::apply([&](auto&... acc) { (Metrics::accumulate(acc, query.kmers[query_i], reference.get(reference_i)), ...); }, accumulators);
+    });
+    perf::count(perf::Counter::probes, reference.size());
+    perf::count(perf::Counter::matched_contexts, matched);
+    perf::count(perf::Counter::pairs_computed);
+
+    return metric::finalise_all<Metrics...>(accumulators, { query_norm, reference.squared_norm, size_t(query.size), reference.size(), matched });
+  }
+
+  // Right VLMCs intersected with one left VLMC in a single pass by fused_block.
+  constexpr int block_size = 8;
+
+  /*
+    Every metric of left against count <= block_size right VLMCs in one pass
+    over the sorted kmers of left. The multiway merge keeps the next key of
+    every right VLMC in a small array, so each left kmer is read once per
+    block instead of once per pair, and the accumulators of the block stay on
+    the stack.
+  */
+  template <typename VC, typename... Metrics>
+  void fused_block(VC& left, VC* const* rights, int count, std::array<out_t, sizeof...(Metrics)>* values) {
+    constexpr int64_t exhausted = std::numeric_limits<int64_t>::max();
+    std::array<std::tuple<typename Metrics::accumulator_t...>, block_size> accumulators{};
+    std::array<size_t, block_size> matched{};
+    int64_t next[block_size];
+    const RI_Kmer* cursor[block_size];
+    const RI_Kmer* end[block_size];
+    int remaining = 0;
+    // Left kmers visited and right cursor advances, as the pairwise merge counts its steps.
+    unsigned long nr_probes = 0;
+    for (int b = 0; b < count; b++) {
+      cursor[b] = rights[b]->container.data();
+      end[b] = cursor[b] + rights[b]->size();
+      next[b] = cursor[b] < end[b] ? cursor[b]->integer_rep : exhausted;
+      remaining += cursor[b] < end[b];
+    }
+    auto advance = [&](int b) {
+      nr_probes++;
+      if (++cursor[b] < end[b]) {
+        next[b] = cursor[b]->integer_rep;
+      }
+      else {
+        next[b] = exhausted;
+        remaining--;
+      }
     };
 
-    if (left.size() < right.size()) {
-      vlmc_container::iterate_kmers(left, right, f);
+    const RI_Kmer* left_end = left.container.data() + left.size();
+    for (const RI_Kmer* left_kmer = left.container.data(); left_kmer < left_end && remaining > 0; left_kmer++) {
+      int64_t key = left_kmer->integer_rep;
+      nr_probes++;
+      for (int b = 0; b < count; b++) {
+        while (next[b] < key) {
+          advance(b);
+        }
+        if (next[b] == key) {
+          matched[b]++;
+          std::apply([&](auto&... acc) { (Metrics::accumulate(acc, *left_kmer, *cursor[b]), ...); }, accumulators[b]);
+          advance(b);
+        }
+      }
     }
-    else {
-      vlmc_container::iterate_kmers(right, left, f);
+    perf::count(perf::Counter::probes, nr_probes);
+    perf::count(perf::Counter::pairs_computed, count);
+
+    for (int b = 0; b < count; b++) {
+      perf::count(perf::Counter::matched_contexts, matched[b]);
+      values[b] = metric::finalise_all<Metrics...>(accumulators[b], { left.squared_norm, rights[b]->squared_norm, left.size(), rights[b]->size(), matched[b] });
     }
+  }
 
-    return normalise_dvstar(dot_product, left_norm, right_norm);
+  template <typename VC, typename... Metrics>
+  std::array<out_t, sizeof...(Metrics)> fused(VC& left, VC& right, metric::metric_list<Metrics...>) {
+    return fused<VC, Metrics...>(left, right);
   }
 
-  void dvstar_kmer_major(bucket_t& left_vector, bucket_t& right_vector,
-    matrix_t& dot_prod, matrix_t& left_norm, matrix_t& right_norm) {
+  template <typename VC>
+  out_t dvstar(VC& left, VC& right) {
+    return fused<VC, metric::Dvstar>(left, right)[0];
+  }
+
+  template <typename... Metrics>
+  using accumulator_tuple_t = std::tuple<typename Metrics::accumulator_t...>;
+
+  /*
+    Accumulates every pair of kmers in a bucket into a row-major (left_id, right_id)
+    array of accumulators with row length right_count, and counts the match in matched.
+  */
+  template <typename... Metrics>
+  void kmer_major(bucket_t& left_vector, bucket_t& right_vector,
+    std::vector<accumulator_tuple_t<Metrics...>>& accumulators, std::vector<size_t>& matched, size_t right_count) {
     auto rec_fun = [&](size_t& left, size_t& right) {
       auto left_id = left_vector[left].id;
       auto right_id = right_vector[right].id;
-      auto left_kmer = left_vector[left].kmer;
-      auto right_kmer = right_vector[right].kmer;
-      dot_prod(left_id, right_id) += ((left_kmer.next_char_prob[0] * right_kmer.next_char_prob[0]) +
-        (left_kmer.next_char_prob[1] * right_kmer.next_char_prob[1]) +
-        (left_kmer.next_char_prob[2] * right_kmer.next_char_prob[2]) +
-        (left_kmer.next_char_prob[3] * right_kmer.next_char_prob[3]));
-      left_norm(left_id, right_id) += ((left_kmer.next_char_prob[0] * left_kmer.next_char_prob[0]) +
-        (left_kmer.next_char_prob[1] * left_kmer.next_char_prob[1]) +
-        (left_kmer.next_char_prob[2] * left_kmer.next_char_prob[2]) +
-        (left_kmer.next_char_prob[3] * left_kmer.next_char_prob[3]));
-      right_norm(left_id, right_id) += ((right_kmer.next_char_prob[0] * right_kmer.next_char_prob[0]) +
-        (right_kmer.next_char_prob[1] * right_kmer.next_char_prob[1]) +
-        (right_kmer.next_char_prob[2] * right_kmer.next_char_prob[2]) +
-        (right_kmer.next_char_prob[3] * right_kmer.next_char_prob[3]));
+      auto& left_kmer = left_vector[left].kmer;
+      auto& right_kmer = right_vector[right].kmer;
+      std::apply([&](auto&... acc) { (Metrics::accumulate(acc, left_kmer, right_kmer), ...); },
+        accumulators[left_id * right_count + right_id]);
+      matched[left_id * right_count + right_id]++;
     };
 
     utils::matrix_recursion(0, left_vector.size(), 0, right_vector.size(), rec_fun);
+    perf::count(perf::Counter::matched_contexts, left_vector.size() * right_vector.size());
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <math.h>
+#include <array>
+#include <tuple>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+#include "read_in_kmer.hpp"
+#include "global_aliases.hpp"
+
+namespace distance {
+
+  using RI_Kmer = kmers::RI_Kmer;
+
+  out_t normalise_dvstar(acc_t dot_product, acc_t left_norm, acc_t right_norm) {
+
+    left_norm = std::sqrt(left_norm);
+    right_norm = std::sqrt(right_norm);
+    if (left_norm == 0 || right_norm == 0) {
+      return 1.0;
+    }
+    else {
+      out_t Dvstar = dot_product / (left_norm * right_norm);
+
+      out_t angular_distance = 2 * std::acos(Dvstar) / M_PI;
+      if (isnan(angular_distance)) {
+        return 0.0;
+      }
+      else {
+        return angular_distance;
+      }
+    }
+  }
+
+  // Products are taken in acc_t, so float storage can still be accumulated in double.
+  inline acc_t dot(const RI_Kmer& left_kmer, const RI_Kmer& right_kmer) {
+    return ((acc_t(left_kmer.next_char_prob[0]) * right_kmer.next_char_prob[0]) +
+      (acc_t(left_kmer.next_char_prob[1]) * right_kmer.next_char_prob[1]) +
+      (acc_t(left_kmer.next_char_prob[2]) * right_kmer.next_char_prob[2]) +
+      (acc_t(left_kmer.next_char_prob[3]) * right_kmer.next_char_prob[3]));
+  }
+
+  /*
+    Metrics are stateless types with an accumulator that is updated once per
+    matched context and a finaliser that turns the accumulator into a distance,
+    given the norms of the two VLMCs if the metric needs them.
+    The accumulators are plain aggregates so that a fused traversal keeps them
+    on the stack (or in registers).
+  */
+  namespace metric {
+
+    // Squared norms and sizes of the two VLMCs of a pair, and the number of contexts they share.
+    struct Norms {
+      acc_t left = 0.0;
+      acc_t right = 0.0;
+      size_t left_size = 0;
+      size_t right_size = 0;
+      size_t matched = 0;
+    };
+
+    struct Dot_norm_accumulator {
+      acc_t dot_product = 0.0;
+      acc_t left_norm = 0.0;
+      acc_t right_norm = 0.0;
+    };
+
+    inline void accumulate_dot_norm(Dot_norm_accumulator& acc, const RI_Kmer& left_kmer, const RI_Kmer& right_kmer) {
+      acc.dot_product += dot(left_kmer, right_kmer);
+      acc.left_norm += dot(left_kmer, left_kmer);
+      acc.right_norm += dot(right_kmer, right_kmer);
+    }
+
+    // Angular distance between the background-corrected probability vectors.
+    struct Dvstar {
+      static constexpr const char* name = "dvstar";
+      using accumulator_t = Dot_norm_accumulator;
+
+      static inline void accumulate(accumulator_t& acc, const RI_Kmer& left_kmer, const RI_Kmer& right_kmer) {
+        accumulate_dot_norm(acc, left_kmer, right_kmer);
+      }
+
+      static inline out_t finalise(const accumulator_t& acc) {
+        return normalise_dvstar(acc.dot_product, acc.left_norm, acc.right_norm);
+      }
+    };
+
+    // 1 - cosine similarity over all contexts, a context missing from one VLMC only adds to its norm.
+    struct Cosine {
+      static constexpr const char* name = "cosine";
+      using accumulator_t = Dot_norm_accumulator;
+
+      static inline void accumulate(accumulator_t& acc, const RI_Kmer& left_kmer, const RI_Kmer& right_kmer) {
+        accumulate_dot_norm(acc, left_kmer, right_kmer);
+      }
+
+      static inline out_t finalise(const accumulator_t& acc, const Norms& norms) {
+        if (norms.left == 0 || norms.right == 0) {
+          return 1.0;
+        }
+        return 1.0 - acc.dot_product / (std::sqrt(norms.left) * std::sqrt(norms.right));
+      }
+    };
+
+    // The D2 statistic, the inner product of the background-corrected vectors. A similarity, not normalised.
+    struct D2 {
+      static constexpr const char* name = "d2";
+      using accumulator_t = Dot_norm_accumulator;
+
+      static inline void accumulate(accumulator_t& acc, const RI_Kmer& left_kmer, const RI_Kmer& right_kmer) {
+        acc.dot_product += dot(left_kmer, right_kmer);
+      }
+
+      static inline out_t finalise(const accumulator_t& acc) { return acc.dot_product; }
+    };
+
+    // Euclidean distance over all contexts, where a context missing from one VLMC counts as zero there.
+    struct Euclidean {
+      static constexpr const char* name = "euclidean";
+      struct accumulator_t {
+        acc_t squared_distance = 0.0;
+        acc_t left_norm = 0.0;
+        acc_t right_norm = 0.0;
+      };
+
+      static inline void accumulate(accumulator_t& acc, const RI_Kmer& left_kmer, const RI_Kmer& right_kmer) {
+        for (int x = 0; x < 4; x++) {
+          acc_t diff = acc_t(left_kmer.next_char_prob[x]) - right_kmer.next_char_prob[x];
+          acc.squared_distance += diff * diff;
+        }
+        acc.left_norm += dot(left_kmer, left_kmer);
+        acc.right_norm += dot(right_kmer, right_kmer);
+      }
+
+      // The unmatched contexts add what the matched ones leave of the squared norm of their VLMC.
+      static inline out_t finalise(const accumulator_t& acc, const Norms& norms) {
+        return std::sqrt(acc.squared_distance + unmatched_norm(norms.left, acc.left_norm, norms.left_size == norms.matched) +
+          unmatched_norm(norms.right, acc.right_norm, norms.right_size == norms.matched));
+      }
+
+      // |l - r|^2 = l.l + r.r - 2 l.r, clamped since the terms are rounded.
+      static inline accumulator_t from_dot_norm(const Dot_norm_accumulator& acc) {
+        return { std::max(acc_t(0.0), acc.left_norm + acc.right_norm - 2 * acc.dot_product), acc.left_norm, acc.right_norm };
+      }
+
+      // Nothing is left if every context matched, the two sums only differ in rounding then.
+      static inline acc_t unmatched_norm(acc_t total, acc_t matched, bool all_matched) {
+        return all_matched ? acc_t(0.0) : std::max(acc_t(0.0), total - matched);
+      }
+    };
+
+    // Metrics that count the contexts in only one VLMC are finalised with the norms of both.
+    template <typename M, typename = void>
+    struct uses_norms : std::false_type {};
+
+    template <typename M>
+    struct uses_norms<M, std::void_t<decltype(M::finalise(std::declval<const typename M::accumulator_t&>(), std::declval<const Norms&>()))>>
+      : std::true_type {};
+
+    template <typename M>
+    inline out_t finalise(const typename M::accumulator_t& acc, const Norms& norms) {
+      if constexpr (uses_norms<M>::value) {
+        return M::finalise(acc, norms);
+      }
+      else {
+        return M::finalise(acc);
+      }
+    }
+
+    // Finalises M from a dot product and norms, for traversals that only accumulate those.
+    template <typename M>
+    inline out_t finalise_from_dot_norm(const Dot_norm_accumulator& acc, const Norms& norms) {
+      if constexpr (std::is_same_v<typename M::accumulator_t, Dot_norm_accumulator>) {
+        return finalise<M>(acc, norms);
+      }
+      else {
+        return finalise<M>(M::from_dot_norm(acc), norms);
+      }
+    }
+
+    // Every metric of Metrics from the tuple of their accumulators.
+    template <typename... Metrics>
+    inline std::array<out_t, sizeof...(Metrics)> finalise_all(const std::tuple<typename Metrics::accumulator_t...>& accumulators,
+      const Norms& norms) {
+      return std::apply([&](const auto&... acc) {
+        return std::array<out_t, sizeof...(Metrics)>{ finalise<Metrics>(acc, norms)... };
+      }, accumulators);
+    }
+
+    // Every metric selectable from the command line, in output order.
+    using all_metrics = std::tuple<Dvstar, Euclidean, Cosine, D2>;
+
+    template <typename... Metrics>
+    struct metric_list {
+      static constexpr size_t size = sizeof...(Metrics);
+    };
+
+    template <typename... Metrics>
+    std::vector<std::string> names(metric_list<Metrics...>) {
+      return { Metrics::name... };
+    }
+
+    /*
+      Turns a runtime bitmask (bit i selects the i'th type of all_metrics) into
+      a metric_list type and calls fun with it. Iterating all_metrics in a fixed
+      order bounds the number of instantiations to 2^|all_metrics|.
+    */
+    template <size_t I = 0, typename... Selected, typename Fun>
+    auto dispatch(unsigned mask, Fun&& fun) {
+      if constexpr (I == std::tuple_size_v<all_metrics>) {
+        return fun(metric_list<Selected...>{});
+      }
+      else {
+        using M = std::tuple_element_t<I, all_metrics>;
+        if (mask & (1u << I)) {
+          return dispatch<I + 1, Selected..., M>(mask, fun);
+        }
+        return dispatch<I + 1, Selected...>(mask, fun);
+      }
+    }
+  }
+}
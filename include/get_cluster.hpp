@@ -1,58 +1,137 @@
 #pragma once
 
+#include <numeric>
 #include <filesystem>
 #include <thread>
 #include <mutex>
+#include <type_traits>
 
 #include "cluster_container.hpp"
+#include "cluster_arena.hpp"
 #include "global_aliases.hpp"
 #include "parallel.hpp"
+#include "perf_report.hpp"
+#include "trace.hpp"
+#include "catalog.hpp"
+#include "bundle.hpp"
 
 namespace get_cluster {
-  template <typename VC>
-  cluster_container::Cluster_Container<VC> get_cluster(const std::filesystem::path& directory, size_t nr_cores_to_use,
-    const size_t background_order, const int set_size = -1) {
+  struct Collection {
     std::vector<std::filesystem::path> paths{};
-
-    for (const auto& dir_entry : recursive_directory_iterator(directory)) {
-      paths.push_back(dir_entry.path());
+    // K-mers of each VLMC, only known from a catalog.
+    std::vector<size_t> nr_kmers{};
+  };
+
+  // The VLMCs of a directory, catalog or bundle in cluster order, at most set_size of them.
+  Collection get_collection(const std::filesystem::path& directory, const int set_size = -1) {
+    perf::Phase_Timer timer{ perf::Phase::phase_scan };
+    Collection collection{};
+    if (bundle::is_bundle(directory)) {
+      collection.paths = bundle::open(directory);
+    }
+    else if (catalog::is_catalog(directory)) {
+      bool current = true;
+      for (auto& entry : catalog::read(directory).entries) {
+        collection.paths.push_back(entry.path);
+        collection.nr_kmers.push_back(entry.nr_kmers);
+        current = current && catalog::is_current(entry);
+      }
+      // The k-mer counts of files changed since are wrong, the VLMCs are then sized as for a directory.
+      if (!current) {
+        std::cerr << "Warning: " << directory.string() << " lists files that changed since, run 'catalog' again." << std::endl;
+        collection.nr_kmers.clear();
+      }
+    }
+    else {
+      for (const auto& dir_entry : recursive_directory_iterator(directory)) {
+        if (dir_entry.is_regular_file()) {
+          collection.paths.push_back(dir_entry.path());
+        }
+      }
     }
+    if ((set_size != -1) && (set_size < collection.paths.size())) {
+      collection.paths.resize(set_size);
+      collection.nr_kmers.resize(std::min<size_t>(set_size, collection.nr_kmers.size()));
+    }
+    return collection;
+  }
 
+  std::vector<std::filesystem::path> get_paths(const std::filesystem::path& directory, const int set_size = -1) {
+    return get_collection(directory, set_size).paths;
+  }
+
+  // With loaded_paths, also returns the paths of the VLMCs in cluster order.
+  template <typename VC>
+  cluster_container::Cluster_Container<VC> get_cluster(const std::filesystem::path& directory, size_t nr_cores_to_use,
+    const size_t background_order, const int set_size = -1, std::vector<std::filesystem::path>* loaded_paths = nullptr) {
+    auto collection = get_collection(directory, set_size);
+    auto& paths = collection.paths;
     size_t paths_size = paths.size();
-    if ((set_size != -1) && (set_size < paths_size)) {
-      paths_size = set_size;
-    }
 
+    // With fewer VLMCs than cores, every constructor gets the cores left over for sorting and layout.
+    size_t build_threads = std::max<size_t>(1, nr_cores_to_use / std::max<size_t>(1, paths_size));
     if (nr_cores_to_use > paths_size)
       nr_cores_to_use = paths_size;
-    if (nr_cores_to_use > 4)
-      nr_cores_to_use = 4;
 
-    cluster_container::Cluster_Container<VC> cluster{paths_size};
-
-    auto fun = [&](size_t start_index, size_t stop_index) {
-      for (int index = start_index; index < stop_index; index++) {
+    // The array layouts are views into one arena for the whole cluster.
+    constexpr bool uses_arena = std::is_constructible_v<VC, const std::filesystem::path&, size_t, cluster_arena::Arena&>;
+    std::shared_ptr<cluster_arena::Arena> arena{};
+    if (uses_arena) {
+      size_t nr_nodes = numa::enabled ? numa::topology.nr_nodes() : 1;
+      size_t capacity = collection.nr_kmers.empty() ? cluster_arena::estimate_capacity(paths, paths_size)
+        : cluster_arena::estimate_capacity(collection.nr_kmers);
+      arena = std::make_shared<cluster_arena::Arena>(capacity, nr_nodes);
+    }
+    cluster_container::Cluster_Container<VC> cluster{paths_size, arena};
+
+    auto build = [&](size_t index) {
+      trace::Scope span{ "container_build", long(index) };
+      numa::pin_to_node(numa::node_of_index(index, paths_size));
+      // Containers that sort or lay out their kmers take a thread count as well.
+      if constexpr (std::is_constructible_v<VC, const std::filesystem::path&, size_t, cluster_arena::Arena&, size_t>) {
+        cluster[index] = VC(paths[index], background_order, *arena, build_threads);
+      }
+      else if constexpr (uses_arena) {
+        cluster[index] = VC(paths[index], background_order, *arena);
+      }
+      else if constexpr (std::is_constructible_v<VC, const std::filesystem::path&, size_t, bool, size_t>) {
+        cluster[index] = VC(paths[index], background_order, false, build_threads);
+      }
+      else {
         cluster[index] = VC(paths[index], background_order);
       }
     };
 
-    parallel::parallelize(paths_size, fun, nr_cores_to_use);
+    if (collection.nr_kmers.empty()) {
+      parallel::parallelize(paths_size, [&](size_t start_index, size_t stop_index) {
+        for (size_t index = start_index; index < stop_index; index++) {
+          build(index);
+        }
+      }, nr_cores_to_use);
+    }
+    else {
+      // With the sizes known, the largest VLMCs are loaded first so that the threads finish together.
+      std::vector<size_t> order(paths_size);
+      std::iota(order.begin(), order.end(), 0);
+      std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return collection.nr_kmers[a] > collection.nr_kmers[b]; });
+      std::vector<size_t> node_of_item(paths_size);
+      for (size_t k = 0; k < paths_size; k++) {
+        node_of_item[k] = numa::node_of_index(order[k], paths_size);
+      }
+      parallel::parallelize_dynamic(node_of_item, [&](size_t k) { build(order[k]); }, nr_cores_to_use);
+    }
+    if (loaded_paths != nullptr) {
+      *loaded_paths = paths;
+    }
 
     return cluster;
   }
 
+  // Same loaded_paths as get_cluster.
   std::vector<cluster_container::Kmer_Cluster> get_kmer_cluster(const std::filesystem::path& directory, size_t nr_cores_to_use,
-    const size_t background_order = 0, const int set_size = -1) {
-    std::vector<std::filesystem::path> paths{};
-
-    for (const auto& dir_entry : recursive_directory_iterator(directory)) {
-      paths.push_back(dir_entry.path());
-    }
-
+    const size_t background_order = 0, const int set_size = -1, std::vector<std::filesystem::path>* loaded_paths = nullptr) {
+    auto paths = get_paths(directory, set_size);
     size_t paths_size = paths.size();
-    if ((set_size != -1) && (set_size < paths_size)) {
-      paths_size = set_size;
-    }
 
     if (nr_cores_to_use > paths_size)
       nr_cores_to_use = paths_size;
@@ -61,19 +140,10 @@ namespace get_cluster {
 
     auto fun = [&](size_t start_index, size_t stop_index, size_t idx) {
       for (int index = start_index; index < stop_index; index++) {
-        std::vector<kmers::RI_Kmer> input_vector{};
-        eigenx_t cached_context((int)std::pow(4, background_order), 4);
-
-        auto fun = [&](const kmers::RI_Kmer& kmer) { input_vector.push_back(kmer); };
-
-        int offset_to_remove = vlmc_container::load_VLMCs_from_file(paths[index], cached_context, fun, background_order);
-
-        for (auto kmer : input_vector) {
-          int background_idx = kmer.background_order_index(kmer.integer_rep, background_order);
-          int offset = background_idx - offset_to_remove;
-          for (int x = 0; x < 4; x++) {
-            kmer.next_char_prob[x] *= 1.0 / std::sqrt(cached_context(offset, x));
-          }
+        trace::Scope span{ "container_build", index };
+        // The buckets are keyed, so the kmers need no sorting.
+        auto loaded = vlmc_container::load_normalised(paths[index], background_order, 1, false);
+        for (auto& kmer : loaded.kmers) {
           clusters[idx].push(cluster_container::Kmer_Pair{kmer, index - start_index});
         }
       }
@@ -81,6 +151,9 @@ namespace get_cluster {
     };
 
     parallel::parallelize_kmer_major(paths_size, fun, nr_cores_to_use);
+    if (loaded_paths != nullptr) {
+      *loaded_paths = paths;
+    }
 
     return clusters;
   }
@@ -3,13 +3,36 @@
 #include <Eigen/Core>
 #include "kmer.hpp"
 
+// PRECISION
+// Set by the VLMC_PRECISION cmake option: double, mixed (float storage, double accumulation) or float.
+#if defined(VLMC_FLOAT_ACCUMULATION) && !defined(VLMC_FLOAT_STORAGE)
+#define VLMC_FLOAT_STORAGE
+#endif
+
+#if defined(VLMC_FLOAT_STORAGE)
+using prob_t = float;
+#else
+using prob_t = double;
+#endif
+
+#if defined(VLMC_FLOAT_ACCUMULATION)
+using acc_t = float;
+constexpr const char* precision_name = "float";
+#elif defined(VLMC_FLOAT_STORAGE)
+using acc_t = double;
+constexpr const char* precision_name = "mixed";
+#else
+using acc_t = double;
+constexpr const char* precision_name = "double";
+#endif
+
 // OUTPUT TYPE
-using out_t = double;
+using out_t = acc_t;
 
 // EIGEN
-using eigen_t = Eigen::Array4d;
-using eigenx_t = Eigen::ArrayX4d;
-using matrix_t = Eigen::MatrixXd;
+using eigen_t = Eigen::Array<prob_t, 4, 1>;
+using eigenx_t = Eigen::Array<prob_t, Eigen::Dynamic, 4>;
+using matrix_t = Eigen::Matrix<out_t, Eigen::Dynamic, Eigen::Dynamic>;
 
 // FILESYSTEM
 using recursive_directory_iterator = std::filesystem::recursive_directory_iterator;
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <cstring>
+#include <iostream>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/*
+  Hardware performance counters through perf_event_open. The counters are
+  opened with 'inherit' on the calling thread before any workers are spawned,
+  so once the workers are joined the values include their events. Where
+  perf_event_open is not available or not permitted (see
+  /proc/sys/kernel/perf_event_paranoid) the collector reports itself as
+  unavailable and every value as zero.
+*/
+namespace hw_counters {
+  enum Event {
+    cycles,
+    instructions,
+    cache_misses,
+    dtlb_misses,
+    branch_misses,
+    // Loads served by the memory of another NUMA node.
+    node_load_misses,
+    nr_events
+  };
+
+  constexpr std::array<const char*, nr_events> event_names{
+    "cycles", "instructions", "cache_misses", "dtlb_misses", "branch_misses", "node_load_misses" };
+
+  struct Sample {
+    std::array<double, nr_events> values{};
+    std::array<bool, nr_events> valid{};
+
+    bool any_valid() const {
+      for (auto v : valid) {
+        if (v) return true;
+      }
+      return false;
+    }
+  };
+
+  class Collector {
+  private:
+    std::array<int, nr_events> fds{};
+
+#if defined(__linux__)
+    static int open_event(unsigned type, unsigned long long config) {
+      perf_event_attr attr{};
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = type;
+      attr.config = config;
+      attr.disabled = 1;
+      attr.inherit = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+
+  public:
+    Collector() {
+      fds.fill(-1);
+#if defined(__linux__)
+      fds[cycles] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+      fds[instructions] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+      fds[cache_misses] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+      fds[dtlb_misses] = open_event(PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+      fds[branch_misses] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+      fds[node_load_misses] = open_event(PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+#endif
+      if (!available()) {
+        std::cerr << "Warning: hardware performance counters are not available, "
+          << "check /proc/sys/kernel/perf_event_paranoid." << std::endl;
+      }
+    }
+
+    ~Collector() {
+#if defined(__linux__)
+      for (auto fd : fds) {
+        if (fd != -1) {
+          close(fd);
+        }
+      }
+#endif
+    }
+
+    Collector(const Collector&) = delete;
+    Collector& operator=(const Collector&) = delete;
+
+    bool available() const {
+      for (auto fd : fds) {
+        if (fd != -1) return true;
+      }
+      return false;
+    }
+
+    void start() {
+#if defined(__linux__)
+      for (auto fd : fds) {
+        if (fd != -1) {
+          ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+          ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+      }
+#endif
+    }
+
+    // Values are scaled up when the kernel had to multiplex the counters.
+    Sample stop() {
+      Sample sample{};
+#if defined(__linux__)
+      for (size_t e = 0; e < nr_events; e++) {
+        if (fds[e] == -1) {
+          continue;
+        }
+        ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+        unsigned long long buffer[3]{};
+        if (read(fds[e], buffer, sizeof(buffer)) == sizeof(buffer) && buffer[2] > 0) {
+          sample.values[e] = double(buffer[0]) * double(buffer[1]) / double(buffer[2]);
+          sample.valid[e] = true;
+        }
+      }
+#endif
+      return sample;
+    }
+  };
+
+  // Runs fun between start and stop of the collector.
+  template <typename Fun>
+  Sample measure(Collector& collector, Fun&& fun) {
+    collector.start();
+    fun();
+    return collector.stop();
+  }
+
+  // Json object with every valid event divided by each of the given (name, count) normalisers.
+  std::string to_json(const Sample& sample, const std::array<std::pair<const char*, double>, 2>& normalisers) {
+    std::string json = "{";
+    bool first = true;
+    for (size_t e = 0; e < nr_events; e++) {
+      if (!sample.valid[e]) {
+        continue;
+      }
+      json += std::string(first ? "" : ", ") + "\"" + event_names[e] + "\": " + std::to_string(sample.values[e]);
+      first = false;
+      for (auto& [name, count] : normalisers) {
+        if (count > 0) {
+          json += std::string(", \"") + event_names[e] + "_per_" + name + "\": " + std::to_string(sample.values[e] / count);
+        }
+      }
+    }
+    return json + "}";
+  }
+}
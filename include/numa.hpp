@@ -0,0 +1,176 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <algorithm>
+#include <filesystem>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+/*
+  NUMA aware mode for the '--numa' flag. Workers are pinned to the cpus of a
+  node, and VLMC index i is loaded, stored and compared on node
+  i * nr_nodes / size, so that the contiguous index blocks given to the
+  workers by parallel::get_x_bounds stay on one node. Memory is placed by
+  first touch from the pinned threads and, on a real multi-node topology,
+  bound with mbind. A fake topology splits the cpus of a single node machine
+  into several nodes to exercise the same code paths, without any binding.
+*/
+namespace numa {
+  struct Topology {
+    // Cpus of each node.
+    std::vector<std::vector<int>> node_cpus{};
+    bool fake = false;
+
+    size_t nr_nodes() const { return node_cpus.size(); }
+  };
+
+  inline bool enabled = false;
+  inline Topology topology{};
+
+  // Parses a cpulist such as "0-3,8-11".
+  std::vector<int> parse_cpulist(const std::string& list) {
+    std::vector<int> cpus{};
+    std::stringstream ss{ list };
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+      if (range.empty() || range == "\n") {
+        continue;
+      }
+      auto dash = range.find('-');
+      int first = std::stoi(range.substr(0, dash));
+      int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last; cpu++) {
+        cpus.push_back(cpu);
+      }
+    }
+    return cpus;
+  }
+
+  std::vector<int> all_cpus() {
+    std::vector<int> cpus{};
+    for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) {
+      cpus.push_back(cpu);
+    }
+    return cpus;
+  }
+
+  // Nodes from /sys/devices/system/node, a single node with every cpu where that is not available.
+  Topology detect() {
+    Topology detected{};
+    const std::filesystem::path node_dir{ "/sys/devices/system/node" };
+    for (int node = 0; std::filesystem::exists(node_dir / ("node" + std::to_string(node))); node++) {
+      std::ifstream cpulist{ node_dir / ("node" + std::to_string(node)) / "cpulist" };
+      std::string list;
+      std::getline(cpulist, list);
+      detected.node_cpus.push_back(parse_cpulist(list));
+    }
+    if (detected.node_cpus.empty()) {
+      detected.node_cpus.push_back(all_cpus());
+    }
+    return detected;
+  }
+
+  // Splits the cpus into nr_nodes contiguous groups, cpus are shared when there are fewer cpus than nodes.
+  Topology fake_topology(size_t nr_nodes) {
+    Topology fake{};
+    fake.fake = true;
+    auto cpus = all_cpus();
+    for (size_t node = 0; node < nr_nodes; node++) {
+      size_t first = node * cpus.size() / nr_nodes;
+      size_t last = std::max(first + 1, (node + 1) * cpus.size() / nr_nodes);
+      fake.node_cpus.emplace_back(cpus.begin() + first, cpus.begin() + std::min(last, cpus.size()));
+    }
+    return fake;
+  }
+
+  size_t node_of_index(size_t index, size_t size) {
+    if (!enabled || size == 0) {
+      return 0;
+    }
+    return index * topology.nr_nodes() / size;
+  }
+
+  // Node the thread was last pinned to, -1 if it never was.
+  inline thread_local int current = -1;
+
+  size_t current_node() { return current < 0 ? 0 : current; }
+
+  // Restricts the calling thread to the cpus of node, a no-op unless the NUMA mode is enabled.
+  void pin_to_node(size_t node) {
+    if (!enabled || node >= topology.nr_nodes() || int(node) == current) {
+      return;
+    }
+    current = node;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : topology.node_cpus[node]) {
+      CPU_SET(cpu, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      std::cerr << "Warning: could not pin thread to node " << node << "." << std::endl;
+    }
+#endif
+  }
+
+  // Prefers node for the pages of [data, data + bytes), only on a real multi-node topology.
+  void bind_memory(void* data, size_t bytes, size_t node) {
+#if defined(__linux__)
+    if (!enabled || topology.fake || topology.nr_nodes() < 2) {
+      return;
+    }
+    unsigned long nodemask = 1ul << node;
+    syscall(SYS_mbind, data, bytes, MPOL_PREFERRED, &nodemask, sizeof(nodemask) * 8, 0);
+#endif
+  }
+
+  /*
+    Sum of the per-node allocation counters in numastat. other_node counts
+    pages a process on another node allocated here, the closest to remote
+    accesses the kernel reports without uncore counters.
+  */
+  struct Numa_Stats {
+    unsigned long numa_hit = 0;
+    unsigned long numa_miss = 0;
+    unsigned long local_node = 0;
+    unsigned long other_node = 0;
+  };
+
+  Numa_Stats read_stats() {
+    Numa_Stats stats{};
+    const std::filesystem::path node_dir{ "/sys/devices/system/node" };
+    for (int node = 0; std::filesystem::exists(node_dir / ("node" + std::to_string(node))); node++) {
+      std::ifstream numastat{ node_dir / ("node" + std::to_string(node)) / "numastat" };
+      std::string name;
+      unsigned long value;
+      while (numastat >> name >> value) {
+        if (name == "numa_hit") stats.numa_hit += value;
+        else if (name == "numa_miss") stats.numa_miss += value;
+        else if (name == "local_node") stats.local_node += value;
+        else if (name == "other_node") stats.other_node += value;
+      }
+    }
+    return stats;
+  }
+
+  // Json object with the topology and the numastat counters accumulated since before.
+  std::string to_json(const Numa_Stats& before, const Numa_Stats& after) {
+    std::string json = "{\"nr_nodes\": " + std::to_string(topology.nr_nodes()) +
+      ", \"fake_topology\": " + (topology.fake ? "true" : "false");
+    json += ", \"numa_hit\": " + std::to_string(after.numa_hit - before.numa_hit);
+    json += ", \"numa_miss\": " + std::to_string(after.numa_miss - before.numa_miss);
+    json += ", \"local_node\": " + std::to_string(after.local_node - before.local_node);
+    json += ", \"other_node\": " + std::to_string(after.other_node - before.other_node);
+    return json + "}";
+  }
+}
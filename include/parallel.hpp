@@ -1,6 +1,9 @@
 #pragma once
 
 #include <stdlib.h>
+#include <atomic>
+#include <algorithm>
+#include <memory>
 #include <cmath>
 #include <functional>
 #include <iostream>
@@ -8,8 +11,18 @@
 #include <vector>
 
 #include "utils.hpp"
+#include "numa.hpp"
 
 namespace parallel {
+  // Runs fun(args...) on a new thread, which is pinned to node in the NUMA mode.
+  template <typename Fun, typename... Args>
+  void spawn(std::vector<std::thread>& threads, size_t node, const Fun& fun, Args... args) {
+    threads.emplace_back([&fun, node, args...]() {
+      numa::pin_to_node(node);
+      fun(args...);
+    });
+  }
+
   std::vector<std::tuple<size_t, size_t>> get_x_bounds(size_t size, const size_t requested_cores) {
     size_t used_cores = utils::get_used_cores(requested_cores, size);
     std::vector<std::tuple<size_t, size_t>> bounds_per_thread{};
@@ -28,80 +41,12 @@ namespace parallel {
     return bounds_per_thread;
   }
 
-  void recursive_get_triangle_coords(std::vector<std::array<int, 6>>& triangle_coords,
-    int x1, int y1, int x2, int y2, int x3, int y3, const int remaining_cores) {
-    if (remaining_cores == 1) {
-      triangle_coords.push_back({ x1, y1, x2, y2, x3, y3 });
-      return;
-    }
-    auto one_to_three = x1 == x3 || y1 == y3;
-    auto two_to_three = x2 == x3 || y2 == y3;
-    auto one_to_two = x1 == x2 || y1 == y2;
-
-    if (two_to_three && one_to_two) {
-      auto new_x = (x3 + x1 + 1) / 2;
-      auto new_y = (y3 + y1 + 1) / 2;
-      if (remaining_cores <= 2) {
-        triangle_coords.push_back({ x1, y1, x2, y2, new_x, new_y });
-        triangle_coords.push_back({ new_x, new_y, x2, y2, x3, y3 });
-      }
-      else {
-        auto cores = remaining_cores - (remaining_cores / 2);
-        recursive_get_triangle_coords(triangle_coords, x1, y1, x2, y2, new_x, new_y, remaining_cores / 2);
-        recursive_get_triangle_coords(triangle_coords, new_x, new_y, x2, y2, x3, y3, cores);
-      }
-    }
-    else if ((two_to_three && not one_to_three) || (one_to_three && one_to_two)) {
-      auto new_x = (x3 + x2 + 1) / 2;
-      auto new_y = (y3 + y2 + 1) / 2;
-      if (remaining_cores <= 2) {
-        triangle_coords.push_back({ x1, y1, x2, y2, new_x, new_y });
-        triangle_coords.push_back({ x1, y1, new_x, new_y, x3, y3 });
-      }
-      else {
-        auto cores = remaining_cores - (remaining_cores / 2);
-        recursive_get_triangle_coords(triangle_coords, x1, y1, x2, y2, new_x, new_y, remaining_cores / 2);
-        recursive_get_triangle_coords(triangle_coords, x1, y1, new_x, new_y, x3, y3, cores);
-      }
-    }
-    else {
-      auto new_x = (x2 + x1 + 1) / 2;
-      auto new_y = (y2 + y1 + 1) / 2;
-      if (remaining_cores <= 2) {
-        triangle_coords.push_back({ x1, y1, new_x, new_y, x3, y3 });
-        triangle_coords.push_back({ new_x, new_y, x2, y2, x3, y3 });
-      }
-      else {
-        auto cores = remaining_cores - (remaining_cores / 2);
-        recursive_get_triangle_coords(triangle_coords, x1, y1, new_x, new_y, x3, y3, remaining_cores / 2);
-        recursive_get_triangle_coords(triangle_coords, new_x, new_y, x2, y2, x3, y3, cores);
-      }
-    }
-  }
-
-  void parallelize_triangle(size_t size, const std::function<void(int, int, int, int, int, int)>& fun, const size_t requested_cores) {
-    std::vector<std::thread> threads{};
-    std::vector<std::array<int, 6>> triangle_coords;
-    size_t used_cores = utils::get_used_cores(requested_cores, size);
-    recursive_get_triangle_coords(triangle_coords, 0, 0, 0, size, size, size, used_cores);
-
-    for (auto& coords : triangle_coords) {
-      threads.emplace_back(fun, coords[0], coords[1], coords[2], coords[3], coords[4], coords[5]);
-    }
-
-    for (auto& thread : threads) {
-      if (thread.joinable()) {
-        thread.join();
-      }
-    }
-  }
-
   void parallelize(size_t size, const std::function<void(size_t, size_t)>& fun, const size_t requested_cores) {
     std::vector<std::thread> threads{};
 
     auto bounds = get_x_bounds(size, requested_cores);
     for (auto& [start_index, stop_index] : bounds) {
-      threads.emplace_back(fun, start_index, stop_index);
+      spawn(threads, numa::node_of_index(start_index, size), fun, start_index, stop_index);
     }
 
     for (auto& thread : threads) {
@@ -116,14 +61,49 @@ namespace parallel {
     if (size_left > size_right) {
       auto bounds = get_x_bounds(size_left, requested_cores);
       for (auto& [start_index, stop_index] : bounds) {
-        threads.emplace_back(fun, start_index, stop_index, 0, size_right);
+        spawn(threads, numa::node_of_index(start_index, size_left), fun, start_index, stop_index, size_t(0), size_right);
       }
     }
     else {
       auto bounds = get_x_bounds(size_right, requested_cores);
       for (auto& [start_index, stop_index] : bounds) {
-        threads.emplace_back(fun, 0, size_left, start_index, stop_index);
+        spawn(threads, numa::node_of_index(start_index, size_right), fun, size_t(0), size_left, start_index, stop_index);
+      }
+    }
+
+    for (auto& thread : threads) {
+      if (thread.joinable()) {
+        thread.join();
+      }
+    }
+  }
+
+  /*
+    Runs fun(i) for every item, handed out one at a time so that items of
+    uneven cost balance over the threads. Each worker takes the items of its
+    own NUMA node first, node_of_item gives the node of every item.
+  */
+  void parallelize_dynamic(const std::vector<size_t>& node_of_item, const std::function<void(size_t)>& fun, const size_t requested_cores) {
+    std::vector<std::thread> threads{};
+    size_t used_cores = utils::get_used_cores(requested_cores, node_of_item.size());
+    size_t nr_nodes = numa::enabled ? numa::topology.nr_nodes() : 1;
+    std::vector<std::vector<size_t>> items(nr_nodes);
+    for (size_t i = 0; i < node_of_item.size(); i++) {
+      items[node_of_item[i] % nr_nodes].push_back(i);
+    }
+    auto next = std::make_unique<std::atomic<size_t>[]>(nr_nodes);
+
+    auto worker = [&](size_t node) {
+      for (size_t offset = 0; offset < nr_nodes; offset++) {
+        size_t queue = (node + offset) % nr_nodes;
+        for (size_t k = next[queue]++; k < items[queue].size(); k = next[queue]++) {
+          fun(items[queue][k]);
+        }
       }
+    };
+    for (size_t w = 0; w < used_cores; w++) {
+      size_t node = numa::node_of_index(w, used_cores);
+      spawn(threads, node, worker, node);
     }
 
     for (auto& thread : threads) {
@@ -150,7 +130,7 @@ namespace parallel {
 
     int idx = 0;
     for (auto& [start_index, stop_index] : bounds) {
-      threads.emplace_back(fun, start_index, stop_index, idx);
+      spawn(threads, numa::node_of_index(start_index, size), fun, size_t(start_index), size_t(stop_index), size_t(idx));
       idx++;
     }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <filesystem>
+#include <vector>
 
 #include "CLI/App.hpp"
 #include "CLI/Config.hpp"
@@ -8,6 +9,7 @@
 
 #include "vlmc_container.hpp"
 #include "global_aliases.hpp"
+#include "tree.hpp"
 
 namespace parser {
   enum VLMC_Rep {
@@ -17,7 +19,22 @@ namespace parser {
     vlmc_ey,
     vlmc_hashmap,
     vlmc_kmer_major,
-    vlmc_veb
+    vlmc_veb,
+    vlmc_s_tree,
+    vlmc_quantized_16,
+    vlmc_quantized_8,
+    vlmc_kmer_partitioned,
+    vlmc_rank_bitvector,
+    vlmc_context_trie,
+    vlmc_query_table
+  };
+
+  // Same order as distance::metric::all_metrics, the value is the bit in the metric mask.
+  enum Metric {
+    metric_dvstar,
+    metric_euclidean,
+    metric_cosine,
+    metric_d2
   };
 
   struct cli_arguments {
@@ -28,8 +45,36 @@ namespace parser {
     int set_size{ -1 };
     VLMC_Rep vlmc{ VLMC_Rep::vlmc_sorted_search };
     size_t background_order{ 0 };
+    std::vector<Metric> metrics{ Metric::metric_dvstar };
+    std::filesystem::path perf_report_path{};
+    bool hw_counters{ false };
+    std::filesystem::path trace_path{};
+    bool numa{ false };
+    size_t numa_fake_nodes{ 0 };
+    bool validate_quantization{ false };
+    std::filesystem::path reference_path{};
+    std::string shard{};
+    std::vector<std::filesystem::path> merge_paths{};
+    // Only used if build_tree, which '--tree' sets.
+    tree::Method tree{ tree::Method::method_nj };
+    bool build_tree{ false };
+    std::filesystem::path newick_path{ "tree.nwk" };
+    std::filesystem::path catalog_directory{};
+    std::filesystem::path pack_input{};
+    double filter_fpr{ 0.0 };
   };
 
+  unsigned metric_mask(const std::vector<Metric>& metrics) {
+    unsigned mask = 0;
+    for (auto metric : metrics) {
+      mask |= 1u << metric;
+    }
+    if (mask == 0) {
+      mask = 1u << Metric::metric_dvstar;
+    }
+    return mask;
+  }
+
   size_t parse_dop(size_t requested_cores) {
     if (requested_cores < 1) {
       throw std::invalid_argument("Too low degree of parallelism, must be >= 1");
@@ -39,23 +84,46 @@ namespace parser {
     }
   }
 
-  void add_options(CLI::App& app, cli_arguments& arguments) {
-    std::map<std::string, VLMC_Rep> VLMC_Rep_map{
+  std::map<std::string, VLMC_Rep> vlmc_rep_map() {
+    return {
       {"sbs", VLMC_Rep::vlmc_sorted_search},
       { "sorted-vector", VLMC_Rep::vlmc_sorted_vector },
       { "b-tree", VLMC_Rep::vlmc_b_tree },
       { "eytzinger", VLMC_Rep::vlmc_ey },
       { "hashmap", VLMC_Rep::vlmc_hashmap },
       { "kmer-major", VLMC_Rep::vlmc_kmer_major },
-      { "veb", VLMC_Rep::vlmc_veb }};
+      { "veb", VLMC_Rep::vlmc_veb },
+      { "s-tree", VLMC_Rep::vlmc_s_tree },
+      { "quantized-16", VLMC_Rep::vlmc_quantized_16 },
+      { "quantized-8", VLMC_Rep::vlmc_quantized_8 },
+      { "kmer-partitioned", VLMC_Rep::vlmc_kmer_partitioned },
+      { "rank-bitvector", VLMC_Rep::vlmc_rank_bitvector },
+      { "context-trie", VLMC_Rep::vlmc_context_trie },
+      { "query-table", VLMC_Rep::vlmc_query_table }};
+  }
+
+  std::map<std::string, tree::Method> tree_method_map() {
+    return {
+      {"nj", tree::Method::method_nj},
+      { "upgma", tree::Method::method_upgma }};
+  }
+
+  void add_options(CLI::App& app, cli_arguments& arguments) {
+    auto VLMC_Rep_map = vlmc_rep_map();
+
+    std::map<std::string, Metric> Metric_map{
+      {"dvstar", Metric::metric_dvstar},
+      { "euclidean", Metric::metric_euclidean },
+      { "cosine", Metric::metric_cosine },
+      { "d2", Metric::metric_d2 }};
 
     app.add_option(
       "-p,--VLMC-path", arguments.first_VLMC_path,
-      "Required for distance calculation. 'Primary' path to saved bintree directory. If '-s' is empty it will compute the inter-distance between the trees of the directory.");
+      "Required for distance calculation. 'Primary' path to saved bintree directory, catalog or bundle. If '-s' is empty it will compute the inter-distance between the trees of the directory.");
 
     app.add_option(
       "-s,--snd-VLMC-path", arguments.second_VLMC_path,
-      "Optional 'Secondary' path to saved bintree directory. Calculates distance between the trees specified in -p (primary) and -s (secondary).");
+      "Optional 'Secondary' path to saved bintree directory, catalog or bundle. Calculates distance between the trees specified in -p (primary) and -s (secondary).");
 
     app.add_option("-o,--matrix-path", arguments.out_path,
       "Path to hdf5 file where scores will be stored.");
@@ -72,5 +140,68 @@ namespace parser {
 
     app.add_option("-a, --set-size", arguments.set_size,
       "Number of VLMCs to compute distance function on.");
+
+    app.add_option("-m,--metrics", arguments.metrics,
+      "Comma separated distance metrics, computed in a single traversal and stored as separate datasets.")
+      ->delimiter(',')
+      ->transform(CLI::CheckedTransformer(Metric_map, CLI::ignore_case));
+
+    app.add_option("--perf-report", arguments.perf_report_path,
+      "Path to json file where phase timings, counters and peak memory are written.");
+
+    app.add_flag("--hw-counters", arguments.hw_counters,
+      "Sample cache, TLB and branch misses of the load and distance phases (Linux perf_event_open).");
+
+    app.add_option("--trace", arguments.trace_path,
+      "Path to json file where a per thread timeline is written in the Chrome Trace Event format.");
+
+    app.add_flag("--numa", arguments.numa,
+      "Pin workers to NUMA nodes and place each VLMC on the node of the workers that compare it.");
+
+    app.add_option("--numa-fake-nodes", arguments.numa_fake_nodes,
+      "Split the cpus into this many nodes instead of reading the topology, implies --numa. For testing.");
+
+    app.add_flag("--validate-quantization", arguments.validate_quantization,
+      "Also compute the distances with 16 and 8 bit quantized probabilities and report their maximum absolute error.");
+
+    app.add_option("--reference-matrix", arguments.reference_path,
+      "Hdf5 file of the same comparison from a double precision build, the maximum absolute error of each metric against it is reported.");
+
+    app.add_option("--filter-fpr", arguments.filter_fpr,
+      "False positive rate of a Bloom filter per VLMC, consulted before searching the 'eytzinger', 'b-tree', 'veb', 's-tree' and 'hashmap' containers. Default 0 (no filters).")
+      ->check(CLI::Range(0.0, 0.5));
+
+    app.add_option("--shard", arguments.shard,
+      "Only compute shard i of N, given as i/N, and write its tiles to the hdf5 file of '-o'. Assemble the shards with 'merge'.");
+
+    auto Tree_map = tree_method_map();
+
+    app.add_option("--tree", arguments.tree,
+      "Build a tree from the distances of a single directory with neighbour joining (nj) or UPGMA (upgma), using the first metric.")
+      ->transform(CLI::CheckedTransformer(Tree_map, CLI::ignore_case))
+      ->each([&arguments](const std::string&) { arguments.build_tree = true; });
+
+    app.add_option("--newick-path", arguments.newick_path,
+      "Path to the Newick file written by '--tree'. Default tree.nwk.");
+
+    auto merge = app.add_subcommand("merge", "Assembles the shard files written with '--shard' into the distance matrices.");
+    merge->add_option("shards", arguments.merge_paths, "Shard files, one for each shard.")->required();
+    merge->add_option("-o,--matrix-path", arguments.out_path, "Path to hdf5 file where scores will be stored.")->required();
+
+    auto catalog = app.add_subcommand("catalog",
+      "Writes a catalog of the VLMCs of a directory, which '-p' and '-s' accept instead of the directory.");
+    catalog->add_option("directory", arguments.catalog_directory, "Directory of VLMCs.")->required();
+    catalog->add_option("-o,--catalog-path", arguments.out_path,
+      "Path to the catalog. An existing catalog is updated, only files that changed are read.")->required();
+    catalog->add_option("-n,--max-dop", arguments.dop, "Degree of parallelism. Default 1 (sequential).");
+
+    auto pack = app.add_subcommand("pack",
+      "Packs the VLMCs of a directory, catalog or bundle into one bundle file, which '-p' and '-s' accept instead of the directory.");
+    pack->add_option("input", arguments.pack_input, "Directory, catalog or bundle of VLMCs.")->required();
+    pack->add_option("-o,--bundle-path", arguments.out_path, "Path to the bundle.")->required();
+
+    auto unpack = app.add_subcommand("unpack", "Writes the VLMCs of a bundle to a directory.");
+    unpack->add_option("bundle", arguments.pack_input, "Bundle of VLMCs.")->required();
+    unpack->add_option("-o,--directory", arguments.out_path, "Directory the VLMCs are written to.")->required();
   }
 }
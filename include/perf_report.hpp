@@ -0,0 +1,211 @@
+#pragma once
+
+#include <time.h>
+#include <sys/resource.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+
+/*
+  Low overhead instrumentation for the '--perf-report' flag. Every thread
+  registers its own counters once, so recording is a branch on 'enabled'
+  followed by an unsynchronised add. With reporting off, nothing but the branch
+  is executed.
+*/
+namespace perf {
+  enum Phase {
+    phase_scan,
+    phase_parse,
+    phase_sort,
+    phase_layout,
+    phase_background,
+    phase_intersection,
+    phase_hdf5_write,
+    phase_tree,
+    nr_phases
+  };
+
+  constexpr std::array<const char*, nr_phases> phase_names{
+    "directory_scan", "parse", "sort", "layout_construction", "background_normalisation", "intersection", "hdf5_write", "tree_build" };
+
+  enum Counter {
+    kmers_loaded,
+    pairs_computed,
+    matched_contexts,
+    probes,
+    skipped_blocks,
+    filter_rejects,
+    filter_bytes,
+    nr_counters
+  };
+
+  constexpr std::array<const char*, nr_counters> counter_names{
+    "kmers_loaded", "pairs_computed", "matched_contexts", "probes", "skipped_blocks", "filter_rejects", "filter_bytes" };
+
+  inline bool enabled = false;
+
+  struct Thread_Stats {
+    std::array<unsigned long, nr_counters> counters{};
+    std::array<double, nr_phases> wall_seconds{};
+    std::array<double, nr_phases> cpu_seconds{};
+    std::array<unsigned long, nr_phases> calls{};
+  };
+
+  class Registry {
+  private:
+    std::mutex mutex{};
+    std::vector<std::unique_ptr<Thread_Stats>> threads{};
+    std::vector<std::pair<std::string, std::string>> sections{};
+
+  public:
+    Thread_Stats* register_thread() {
+      std::lock_guard<std::mutex> lock{ mutex };
+      threads.push_back(std::make_unique<Thread_Stats>());
+      return threads.back().get();
+    }
+
+    // Extra top level entries of the report, the value must be valid json.
+    void add_section(const std::string& name, const std::string& json) {
+      std::lock_guard<std::mutex> lock{ mutex };
+      sections.emplace_back(name, json);
+    }
+
+    // Only call once the worker threads have been joined.
+    const std::vector<std::unique_ptr<Thread_Stats>>& get_threads() const { return threads; }
+
+    const std::vector<std::pair<std::string, std::string>>& get_sections() const { return sections; }
+  };
+
+  inline Registry registry{};
+  inline const auto start_time = std::chrono::steady_clock::now();
+
+  inline Thread_Stats& local() {
+    thread_local Thread_Stats* stats = registry.register_thread();
+    return *stats;
+  }
+
+  inline void count(Counter counter, unsigned long n = 1) {
+    if (enabled) {
+      local().counters[counter] += n;
+    }
+  }
+
+  inline double thread_cpu_seconds() {
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+
+  // Adds the wall and cpu time of its scope to the phase of the calling thread.
+  class Phase_Timer {
+  private:
+    Phase phase;
+    bool active;
+    std::chrono::steady_clock::time_point wall_start{};
+    double cpu_start = 0.0;
+
+  public:
+    Phase_Timer(Phase phase) : phase(phase), active(enabled) {
+      if (active) {
+        wall_start = std::chrono::steady_clock::now();
+        cpu_start = thread_cpu_seconds();
+      }
+    }
+
+    ~Phase_Timer() {
+      if (active) {
+        auto& stats = local();
+        stats.wall_seconds[phase] += std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+        stats.cpu_seconds[phase] += thread_cpu_seconds() - cpu_start;
+        stats.calls[phase]++;
+      }
+    }
+
+    Phase_Timer(const Phase_Timer&) = delete;
+    Phase_Timer& operator=(const Phase_Timer&) = delete;
+  };
+
+  // Sum over all threads, only call once the worker threads have been joined.
+  std::array<unsigned long, nr_counters> totals() {
+    std::array<unsigned long, nr_counters> total{};
+    for (auto& stats : registry.get_threads()) {
+      for (size_t c = 0; c < nr_counters; c++) {
+        total[c] += stats->counters[c];
+      }
+    }
+    return total;
+  }
+
+  // Wall seconds of every phase summed over all threads, only call once the worker threads have been joined.
+  std::array<double, nr_phases> phase_wall_seconds() {
+    std::array<double, nr_phases> total{};
+    for (auto& stats : registry.get_threads()) {
+      for (size_t p = 0; p < nr_phases; p++) {
+        total[p] += stats->wall_seconds[p];
+      }
+    }
+    return total;
+  }
+
+  long peak_rss_kb() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+  }
+
+  void write_report(const std::filesystem::path& path) {
+    auto& threads = registry.get_threads();
+    std::ofstream os{ path };
+    os << "{\n";
+    os << "  \"wall_seconds\": " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count() << ",\n";
+    os << "  \"peak_rss_kb\": " << peak_rss_kb() << ",\n";
+    for (auto& [name, json] : registry.get_sections()) {
+      os << "  \"" << name << "\": " << json << ",\n";
+    }
+
+    os << "  \"phases\": {\n";
+    for (size_t p = 0; p < nr_phases; p++) {
+      double wall = 0.0, cpu = 0.0, max_wall = 0.0;
+      unsigned long calls = 0;
+      for (auto& stats : threads) {
+        wall += stats->wall_seconds[p];
+        cpu += stats->cpu_seconds[p];
+        calls += stats->calls[p];
+        max_wall = std::max(max_wall, stats->wall_seconds[p]);
+      }
+      os << "    \"" << phase_names[p] << "\": {\"wall_seconds\": " << wall << ", \"cpu_seconds\": " << cpu
+        << ", \"max_thread_wall_seconds\": " << max_wall << ", \"calls\": " << calls << "}"
+        << (p + 1 < nr_phases ? ",\n" : "\n");
+    }
+    os << "  },\n";
+
+    os << "  \"counters\": {\n";
+    auto total = totals();
+    for (size_t c = 0; c < nr_counters; c++) {
+      os << "    \"" << counter_names[c] << "\": " << total[c] << (c + 1 < nr_counters ? ",\n" : "\n");
+    }
+    os << "  },\n";
+
+    os << "  \"threads\": [\n";
+    for (size_t t = 0; t < threads.size(); t++) {
+      os << "    {";
+      for (size_t c = 0; c < nr_counters; c++) {
+        os << "\"" << counter_names[c] << "\": " << threads[t]->counters[c] << ", ";
+      }
+      os << "\"wall_seconds\": {";
+      for (size_t p = 0; p < nr_phases; p++) {
+        os << "\"" << phase_names[p] << "\": " << threads[t]->wall_seconds[p] << (p + 1 < nr_phases ? ", " : "");
+      }
+      os << "}}" << (t + 1 < threads.size() ? ",\n" : "\n");
+    }
+    os << "  ]\n";
+    os << "}\n";
+  }
+}
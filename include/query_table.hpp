@@ -0,0 +1,159 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <climits>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "read_in_kmer.hpp"
+
+/*
+  One-vs-many comparison: the contexts of a query VLMC are expanded once into
+  a table indexed by key, and the keys of every reference VLMC are looked up
+  in it eight at a time with AVX2 gathers, so no reference needs a search or
+  a merge against the query.
+
+  The table is direct-addressed over the key range of the query when that
+  range is dense enough, and otherwise an open addressing hash table at most
+  half full, where a gather reads the first slot of every key and only keys
+  that collided are probed further one at a time.
+*/
+namespace query_table {
+  constexpr int batch_size = 8;
+  // Direct-addressed when there are at most this many keys in the range per context, as in array::Rank_Bitvector.
+  constexpr long max_range_per_key = 32;
+  constexpr int empty = -1;
+
+  inline uint32_t hash(int key) { return uint32_t(key) * 0x9E3779B1u; }
+
+  struct Query_Table {
+    bool direct = true;
+    int base = 0;
+    // Number of slots when direct-addressed.
+    uint32_t range = 0;
+    // When hashed, the slot of a key is its hash shifted right by shift.
+    int shift = 31;
+    uint32_t mask = 0;
+    std::vector<int> slot_keys{};
+    std::vector<int> slot_indices{};
+    // Not owned, the sorted kmers of the query.
+    const kmers::RI_Kmer* kmers = nullptr;
+    int size = 0;
+
+    Query_Table() = default;
+    ~Query_Table() = default;
+
+    explicit Query_Table(const std::vector<kmers::RI_Kmer>& sorted) : kmers(sorted.data()), size(sorted.size()) {
+      if (sorted.empty()) {
+        return;
+      }
+      long span = long(sorted.back().integer_rep) - sorted.front().integer_rep + 1;
+      direct = span <= max_range_per_key * long(sorted.size());
+      if (direct) {
+        base = sorted.front().integer_rep;
+        range = span;
+        slot_indices.assign(range, empty);
+        for (int i = 0; i < size; i++) {
+          slot_indices[sorted[i].integer_rep - base] = i;
+        }
+        return;
+      }
+      int bits = 1;
+      while ((size_t(1) << bits) < 2 * sorted.size()) {
+        bits++;
+      }
+      shift = 32 - bits;
+      mask = (uint32_t(1) << bits) - 1;
+      slot_keys.assign(size_t(1) << bits, empty);
+      slot_indices.assign(size_t(1) << bits, empty);
+      for (int i = 0; i < size; i++) {
+        uint32_t slot = slot_of(sorted[i].integer_rep);
+        while (slot_keys[slot] != empty) {
+          slot = (slot + 1) & mask;
+        }
+        slot_keys[slot] = sorted[i].integer_rep;
+        slot_indices[slot] = i;
+      }
+    }
+
+    uint32_t slot_of(int key) const { return hash(key) >> shift; }
+
+    // Index of the kmer of key in the query, or empty.
+    int find(int key) const {
+      if (direct) {
+        uint32_t offset = uint32_t(key) - uint32_t(base);
+        return offset < range ? slot_indices[offset] : empty;
+      }
+      for (uint32_t slot = slot_of(key);; slot = (slot + 1) & mask) {
+        if (slot_keys[slot] == key) {
+          return slot_indices[slot];
+        }
+        if (slot_keys[slot] == empty) {
+          return empty;
+        }
+      }
+    }
+
+    // indices[j] = find of the key of kmers[j] for batch_size kmers.
+    void find_batch(const kmers::RI_Kmer* batch, int* indices) const {
+#if defined(__AVX2__)
+      // The keys are gathered straight from the kmers, sizeof(RI_Kmer) apart.
+      constexpr int stride = sizeof(kmers::RI_Kmer) / sizeof(int);
+      __m256i key = _mm256_i32gather_epi32(&batch->integer_rep, _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+        _mm256_set1_epi32(stride)), 4);
+      __m256i none = _mm256_set1_epi32(empty);
+      if (direct) {
+        // offset < range as unsigned, by flipping the sign bits for the signed compare.
+        __m256i flip = _mm256_set1_epi32(INT_MIN);
+        __m256i offset = _mm256_sub_epi32(key, _mm256_set1_epi32(base));
+        __m256i inside = _mm256_cmpgt_epi32(_mm256_set1_epi32(int(range ^ 0x80000000u)), _mm256_xor_si256(offset, flip));
+        __m256i index = _mm256_mask_i32gather_epi32(none, slot_indices.data(), offset, inside, 4);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(indices), index);
+        return;
+      }
+      __m256i slot = _mm256_srl_epi32(_mm256_mullo_epi32(key, _mm256_set1_epi32(int(0x9E3779B1u))), _mm_cvtsi32_si128(shift));
+      __m256i found = _mm256_i32gather_epi32(slot_keys.data(), slot, 4);
+      __m256i hit = _mm256_cmpeq_epi32(found, key);
+      __m256i index = _mm256_mask_i32gather_epi32(none, slot_indices.data(), slot, hit, 4);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(indices), index);
+      // Keys whose first slot holds another key continue probing.
+      __m256i done = _mm256_or_si256(hit, _mm256_cmpeq_epi32(found, none));
+      int collided = ~_mm256_movemask_ps(_mm256_castsi256_ps(done)) & 0xff;
+      while (collided != 0) {
+        int j = __builtin_ctz(collided);
+        indices[j] = find(batch[j].integer_rep);
+        collided &= collided - 1;
+      }
+#else
+      for (int j = 0; j < batch_size; j++) {
+        indices[j] = find(batch[j].integer_rep);
+      }
+#endif
+    }
+
+    // Calls f(query_index, reference_index) for every one of the n reference kmers whose key is in the query.
+    template <typename F>
+    void probe(const kmers::RI_Kmer* references, int n, F&& f) const {
+      int indices[batch_size];
+      int start = 0;
+      for (; start + batch_size <= n; start += batch_size) {
+        find_batch(references + start, indices);
+        for (int j = 0; j < batch_size; j++) {
+          if (indices[j] != empty) {
+            f(indices[j], start + j);
+          }
+        }
+      }
+      for (; start < n; start++) {
+        int index = find(references[start].integer_rep);
+        if (index != empty) {
+          f(index, start);
+        }
+      }
+    }
+  };
+}
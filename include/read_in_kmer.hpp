@@ -9,18 +9,18 @@
 #include "kmer.hpp"
 #include "global_aliases.hpp"
 
-constexpr out_t pseudo_count_amount = 1.0;
+constexpr prob_t pseudo_count_amount = 1.0;
 
 namespace kmers {
   struct RI_Kmer {
     int integer_rep;
-    std::array<out_t, 4> next_char_prob;
+    std::array<prob_t, 4> next_char_prob;
 
     RI_Kmer() = default;
     ~RI_Kmer() = default;
 
     RI_Kmer(const kmers::VLMCKmer& old_kmer) {
-      out_t child_count = old_kmer.next_symbol_counts[0] + old_kmer.next_symbol_counts[1] + old_kmer.next_symbol_counts[2] + old_kmer.next_symbol_counts[3] + 4;
+      prob_t child_count = old_kmer.next_symbol_counts[0] + old_kmer.next_symbol_counts[1] + old_kmer.next_symbol_counts[2] + old_kmer.next_symbol_counts[3] + 4;
       this->next_char_prob = { (old_kmer.next_symbol_counts[0] + pseudo_count_amount) / child_count,
                      (old_kmer.next_symbol_counts[1] + pseudo_count_amount) / child_count,
                      (old_kmer.next_symbol_counts[2] + pseudo_count_amount) / child_count,
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cctype>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+
+/*
+  Splits one comparison into square tiles and divides them over N shards for
+  '--shard i/N', so that separate processes or machines each compute a part of
+  the matrix. The tiling only depends on the matrix shape, the mode and N, so
+  every shard derives the same assignment without coordination.
+*/
+namespace shard {
+  struct Tile {
+    size_t row_start;
+    size_t row_stop;
+    size_t col_start;
+    size_t col_stop;
+
+    size_t rows() const { return row_stop - row_start; }
+    size_t cols() const { return col_stop - col_start; }
+  };
+
+  struct Shard_Spec {
+    size_t index = 0;
+    size_t count = 1;
+  };
+
+  // Parses "i/N" with 0 <= i < N, both plain decimal numbers.
+  Shard_Spec parse(const std::string& spec) {
+    auto is_number = [](const std::string& digits) {
+      return !digits.empty() && digits.size() < 19 && std::all_of(digits.begin(), digits.end(), [](char c) { return std::isdigit(c); });
+    };
+    auto slash = spec.find('/');
+    if (slash == std::string::npos || !is_number(spec.substr(0, slash)) || !is_number(spec.substr(slash + 1))) {
+      throw std::invalid_argument("Shard must be given as i/N, got '" + spec + "'");
+    }
+    Shard_Spec shard{ std::stoul(spec.substr(0, slash)), std::stoul(spec.substr(slash + 1)) };
+    if (shard.count == 0 || shard.index >= shard.count) {
+      throw std::invalid_argument("Shard index must be in [0, N), got '" + spec + "'");
+    }
+    return shard;
+  }
+
+  // About four tiles per shard along the longer side.
+  size_t tile_size(size_t rows, size_t cols, size_t nr_shards) {
+    size_t n = std::max(rows, cols);
+    return std::max<size_t>(1, (n + 4 * nr_shards - 1) / (4 * nr_shards));
+  }
+
+  // Pairs computed for the tile, in triangle mode only those with col >= row.
+  size_t cost(const Tile& tile, bool triangle) {
+    if (!triangle) {
+      return tile.rows() * tile.cols();
+    }
+    size_t pairs = 0;
+    for (size_t row = tile.row_start; row < tile.row_stop; row++) {
+      size_t col = std::max(tile.col_start, row);
+      pairs += col < tile.col_stop ? tile.col_stop - col : 0;
+    }
+    return pairs;
+  }
+
+  // Row-major grid of tiles of side size, without the tiles below the diagonal in triangle mode.
+  std::vector<Tile> make_tiles_of_size(size_t rows, size_t cols, bool triangle, size_t size) {
+    std::vector<Tile> tiles{};
+    for (size_t row = 0; row < rows; row += size) {
+      for (size_t col = 0; col < cols; col += size) {
+        Tile tile{ row, std::min(row + size, rows), col, std::min(col + size, cols) };
+        if (!triangle || cost(tile, triangle) > 0) {
+          tiles.push_back(tile);
+        }
+      }
+    }
+    return tiles;
+  }
+
+  std::vector<Tile> make_tiles(size_t rows, size_t cols, bool triangle, size_t nr_shards) {
+    return make_tiles_of_size(rows, cols, triangle, tile_size(rows, cols, nr_shards));
+  }
+
+  /*
+    Shard of every tile: the tiles in order of decreasing cost, ties by
+    position, each go to the shard with the least work so far (longest
+    processing time first).
+  */
+  std::vector<size_t> assign(const std::vector<Tile>& tiles, bool triangle, size_t nr_shards) {
+    std::vector<size_t> costs(tiles.size());
+    for (size_t t = 0; t < tiles.size(); t++) {
+      costs[t] = cost(tiles[t], triangle);
+    }
+    std::vector<size_t> order(tiles.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+
+    std::vector<size_t> owner(tiles.size());
+    std::vector<size_t> load(nr_shards, 0);
+    for (auto t : order) {
+      size_t shard = std::min_element(load.begin(), load.end()) - load.begin();
+      owner[t] = shard;
+      load[shard] += costs[t];
+    }
+    return owner;
+  }
+
+  std::vector<Tile> shard_tiles(size_t rows, size_t cols, bool triangle, const Shard_Spec& shard) {
+    auto tiles = make_tiles(rows, cols, triangle, shard.count);
+    auto owner = assign(tiles, triangle, shard.count);
+    std::vector<Tile> selected{};
+    for (size_t t = 0; t < tiles.size(); t++) {
+      if (owner[t] == shard.index) {
+        selected.push_back(tiles[t]);
+      }
+    }
+    return selected;
+  }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+#include <filesystem>
+
+#include <highfive/H5File.hpp>
+
+#include "shard.hpp"
+#include "global_aliases.hpp"
+
+/*
+  HDF5 files of the shards. A shard file holds
+    shard/info     rows, cols, triangle, shard index, number of shards
+    shard/metrics  dataset names of the metrics
+    shard/tiles    row_start, row_stop, col_start, col_stop of each tile
+    tiles/<k>/<metric>  the distances of tile k
+  and merge copies the tiles into the 'distances' group of the output one at
+  a time, so neither the shards nor the merge hold the full matrix. Triangle
+  mode tiles are also written mirrored, which fills the whole matrix like a
+  run without shards.
+*/
+namespace shard_file {
+  void write(const std::filesystem::path& path, const shard::Shard_Spec& spec, size_t rows, size_t cols, bool triangle,
+    const std::vector<shard::Tile>& tiles, const std::vector<std::vector<matrix_t>>& tile_distances,
+    const std::vector<std::string>& names) {
+    HighFive::File file{ path.string(), HighFive::File::Overwrite };
+    auto shard_group = file.createGroup("shard");
+    shard_group.createDataSet("info", std::vector<size_t>{ rows, cols, size_t(triangle), spec.index, spec.count });
+    shard_group.createDataSet("metrics", names);
+    std::vector<std::vector<size_t>> coordinates{};
+    for (auto& tile : tiles) {
+      coordinates.push_back({ tile.row_start, tile.row_stop, tile.col_start, tile.col_stop });
+    }
+    shard_group.createDataSet("tiles", coordinates);
+
+    auto tiles_group = file.createGroup("tiles");
+    for (size_t t = 0; t < tiles.size(); t++) {
+      auto tile_group = tiles_group.createGroup(std::to_string(t));
+      for (size_t m = 0; m < names.size(); m++) {
+        tile_group.createDataSet(names[m], tile_distances[t][m]);
+      }
+    }
+  }
+
+  void merge(const std::vector<std::filesystem::path>& shard_paths, const std::filesystem::path& out_path) {
+    if (shard_paths.empty()) {
+      throw std::invalid_argument("No shard files to merge.");
+    }
+    std::vector<size_t> first_info{};
+    std::vector<std::string> names{};
+    std::vector<bool> seen{};
+    size_t nr_tiles = 0;
+
+    HighFive::File out{ out_path.string(), HighFive::File::OpenOrCreate };
+    if (!out.exist("distances")) {
+      out.createGroup("distances");
+    }
+    auto distance_group = out.getGroup("distances");
+
+    for (auto& path : shard_paths) {
+      HighFive::File file{ path.string(), HighFive::File::ReadOnly };
+      auto shard_group = file.getGroup("shard");
+      auto info = shard_group.getDataSet("info").read<std::vector<size_t>>();
+      if (info.size() != 5) {
+        throw std::runtime_error(path.string() + " is not a shard file.");
+      }
+      if (first_info.empty()) {
+        first_info = info;
+        names = shard_group.getDataSet("metrics").read<std::vector<std::string>>();
+        seen.assign(info[4], false);
+        for (auto& name : names) {
+          if (!distance_group.exist(name)) {
+            distance_group.createDataSet<out_t>(name, HighFive::DataSpace(std::vector<size_t>{ info[0], info[1] }));
+          }
+        }
+      }
+      if (info[0] != first_info[0] || info[1] != first_info[1] || info[2] != first_info[2] || info[4] != first_info[4]) {
+        throw std::runtime_error(path.string() + " is a shard of a different comparison.");
+      }
+      if (info[3] >= seen.size()) {
+        throw std::runtime_error(path.string() + " has shard index " + std::to_string(info[3]) + " of " + std::to_string(seen.size()) + ".");
+      }
+      if (seen[info[3]]) {
+        throw std::runtime_error(path.string() + " repeats shard " + std::to_string(info[3]) + ".");
+      }
+      seen[info[3]] = true;
+
+      bool triangle = info[2];
+      auto coordinates = shard_group.getDataSet("tiles").read<std::vector<std::vector<size_t>>>();
+      auto tiles_group = file.getGroup("tiles");
+      for (size_t t = 0; t < coordinates.size(); t++) {
+        auto& c = coordinates[t];
+        auto tile_group = tiles_group.getGroup(std::to_string(t));
+        for (auto& name : names) {
+          matrix_t tile{};
+          tile_group.getDataSet(name).read(tile);
+          auto dataset = distance_group.getDataSet(name);
+          if (triangle && c[0] == c[2]) {
+            // Diagonal tiles only hold their upper triangle.
+            matrix_t upper = tile;
+            tile.triangularView<Eigen::StrictlyLower>() = upper.transpose();
+          }
+          dataset.select({ c[0], c[2] }, { c[1] - c[0], c[3] - c[2] }).write(tile);
+          if (triangle && c[0] != c[2]) {
+            matrix_t mirrored = tile.transpose();
+            dataset.select({ c[2], c[0] }, { c[3] - c[2], c[1] - c[0] }).write(mirrored);
+          }
+        }
+      }
+      nr_tiles += coordinates.size();
+    }
+
+    size_t expected = shard::make_tiles(first_info[0], first_info[1], first_info[2], first_info[4]).size();
+    if (std::find(seen.begin(), seen.end(), false) != seen.end() || nr_tiles != expected) {
+      throw std::runtime_error("Missing shards, merged " + std::to_string(nr_tiles) + " of " + std::to_string(expected) + " tiles.");
+    }
+  }
+}
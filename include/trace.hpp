@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+
+/*
+  Per thread timeline of spans for the '--trace' flag, written in the Chrome
+  Trace Event format (open in Perfetto or chrome://tracing). Each thread
+  appends to its own buffer, the only lock is taken when a thread records its
+  first span.
+*/
+namespace trace {
+  inline bool enabled = false;
+
+  struct Span {
+    const char* name;
+    long start_ns;
+    long duration_ns;
+    std::array<long, 4> args;
+    int nr_args;
+  };
+
+  struct Thread_Buffer {
+    int tid;
+    std::vector<Span> spans{};
+  };
+
+  class Registry {
+  private:
+    std::mutex mutex{};
+    std::vector<std::unique_ptr<Thread_Buffer>> threads{};
+
+  public:
+    Thread_Buffer* register_thread() {
+      std::lock_guard<std::mutex> lock{ mutex };
+      threads.push_back(std::make_unique<Thread_Buffer>());
+      threads.back()->tid = threads.size();
+      threads.back()->spans.reserve(1024);
+      return threads.back().get();
+    }
+
+    // Only call once the worker threads have been joined.
+    const std::vector<std::unique_ptr<Thread_Buffer>>& get_threads() const { return threads; }
+  };
+
+  inline Registry registry{};
+  inline const auto start_time = std::chrono::steady_clock::now();
+
+  inline Thread_Buffer& local() {
+    thread_local Thread_Buffer* buffer = registry.register_thread();
+    return *buffer;
+  }
+
+  inline long now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+  }
+
+  // Records its scope as a span of the calling thread, name must be a string literal.
+  class Scope {
+  private:
+    const char* name;
+    bool active;
+    long start_ns = 0;
+    std::array<long, 4> args{};
+    int nr_args;
+
+  public:
+    Scope(const char* name) : name(name), active(enabled), nr_args(0) {
+      if (active) {
+        start_ns = now_ns();
+      }
+    }
+
+    Scope(const char* name, long a0, long a1 = -1, long a2 = -1, long a3 = -1)
+      : name(name), active(enabled), args{ a0, a1, a2, a3 }, nr_args(a3 != -1 ? 4 : a2 != -1 ? 3 : a1 != -1 ? 2 : 1) {
+      if (active) {
+        start_ns = now_ns();
+      }
+    }
+
+    ~Scope() {
+      if (active) {
+        local().spans.push_back({ name, start_ns, now_ns() - start_ns, args, nr_args });
+      }
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+  };
+
+  void write_trace(const std::filesystem::path& path) {
+    std::ofstream os{ path };
+    os << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+    bool first = true;
+    for (auto& thread : registry.get_threads()) {
+      if (!first) os << ",\n";
+      os << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread->tid
+        << ", \"args\": {\"name\": \"thread " << thread->tid << "\"}}";
+      first = false;
+      for (auto& span : thread->spans) {
+        os << ",\n{\"name\": \"" << span.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread->tid
+          << ", \"ts\": " << span.start_ns / 1000 << "." << std::to_string(1000 + span.start_ns % 1000).substr(1)
+          << ", \"dur\": " << span.duration_ns / 1000 << "." << std::to_string(1000 + span.duration_ns % 1000).substr(1);
+        if (span.nr_args > 0) {
+          os << ", \"args\": {\"values\": [";
+          for (int a = 0; a < span.nr_args; a++) {
+            os << (a > 0 ? ", " : "") << span.args[a];
+          }
+          os << "]}";
+        }
+        os << "}";
+      }
+    }
+    os << "\n]}\n";
+  }
+}
@@ -0,0 +1,330 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+
+#include "parallel.hpp"
+#include "global_aliases.hpp"
+
+/*
+  Tree building on the in-memory distances for '--tree'. Neighbour joining
+  follows RapidNJ: every row keeps its distances sorted, and the search for
+  the pair with the smallest Q stops scanning a row once the row sum bound
+  shows that no later entry can beat the best Q so far. UPGMA uses the
+  nearest neighbour chain, which gives the exact UPGMA tree in O(N^2) time
+  without a heap. Both work in place on the matrix they are given.
+*/
+namespace tree {
+  enum Method {
+    method_nj,
+    method_upgma
+  };
+
+  // Rooted tree, nodes below nr_leaves are the leaves in matrix order and the last node is the root.
+  struct Tree {
+    size_t nr_leaves = 0;
+    // (child, branch length) of each node.
+    std::vector<std::vector<std::pair<size_t, double>>> children{};
+
+    size_t root() const { return children.size() - 1; }
+
+    size_t add_node(std::vector<std::pair<size_t, double>> node_children) {
+      children.push_back(std::move(node_children));
+      return children.size() - 1;
+    }
+  };
+
+  constexpr size_t dead = std::numeric_limits<size_t>::max();
+
+  // Mirrors the upper triangle, which is all that a single cluster computes.
+  void symmetrise(matrix_t& distances) {
+    for (Eigen::Index i = 0; i < distances.rows(); i++) {
+      for (Eigen::Index j = i + 1; j < distances.cols(); j++) {
+        distances(j, i) = distances(i, j);
+      }
+    }
+  }
+
+  Tree leaves(size_t n) {
+    Tree tree{ n };
+    tree.children.resize(n);
+    return tree;
+  }
+
+  Tree neighbour_joining(matrix_t distances, size_t requested_cores = 1) {
+    size_t n = distances.rows();
+    symmetrise(distances);
+    Tree tree = leaves(n);
+    if (n == 2) {
+      tree.add_node({ { 0, distances(0, 1) / 2 }, { 1, distances(0, 1) / 2 } });
+    }
+    if (n <= 2) {
+      return tree;
+    }
+
+    // Sorted row entries, the distance is only used for the bound.
+    struct Entry {
+      float distance;
+      uint32_t node;
+    };
+    std::vector<size_t> node(n);
+    std::vector<size_t> slot_of(2 * n, dead);
+    std::vector<double> row_sum(n, 0.0);
+    std::vector<std::vector<Entry>> rows(n);
+    for (size_t i = 0; i < n; i++) {
+      node[i] = i;
+      slot_of[i] = i;
+      for (size_t j = 0; j < n; j++) {
+        row_sum[i] += j == i ? 0.0 : distances(i, j);
+      }
+    }
+
+    // Every pair is kept in one row only: the row of the lower slot, or the row of the newer node.
+    auto sort_row = [&](size_t i, size_t from) {
+      rows[i].clear();
+      for (size_t j = from; j < n; j++) {
+        if (j != i && node[j] != dead) {
+          // Rounded down, so that the bound stays a lower bound.
+          float distance = float(distances(i, j));
+          if (distance > distances(i, j)) {
+            distance = std::nextafter(distance, -std::numeric_limits<float>::infinity());
+          }
+          rows[i].push_back({ distance, uint32_t(node[j]) });
+        }
+      }
+      std::sort(rows[i].begin(), rows[i].end(), [](const Entry& a, const Entry& b) { return a.distance < b.distance; });
+    };
+    auto in_parallel = [&](size_t size, const std::function<void(size_t, size_t)>& fun) {
+      if (requested_cores > 1 && size >= 1024) {
+        parallel::parallelize(size, fun, requested_cores);
+      }
+      else {
+        fun(0, size);
+      }
+    };
+    in_parallel(n, [&](size_t start, size_t stop) {
+      for (size_t i = start; i < stop; i++) {
+        sort_row(i, i + 1);
+      }
+    });
+
+    size_t remaining = n;
+    size_t live_at_compaction = n;
+    while (remaining > 3) {
+      double max_row_sum = -std::numeric_limits<double>::infinity();
+      for (size_t i = 0; i < n; i++) {
+        if (node[i] != dead) {
+          max_row_sum = std::max(max_row_sum, row_sum[i]);
+        }
+      }
+      double scale = 1.0 / (remaining - 2);
+
+      // Smallest (q, i, j) over the rows, the tuple order keeps the result independent of the threads.
+      struct Best {
+        double q = std::numeric_limits<double>::infinity();
+        size_t i = dead;
+        size_t j = dead;
+
+        bool operator<(const Best& other) const {
+          return q < other.q || (q == other.q && (i < other.i || (i == other.i && j < other.j)));
+        }
+      };
+      Best best{};
+      std::mutex mutex{};
+      in_parallel(n, [&](size_t start, size_t stop) {
+        Best local{};
+        for (size_t i = start; i < stop; i++) {
+          if (node[i] == dead) {
+            continue;
+          }
+          double bound = (row_sum[i] + max_row_sum) * scale;
+          for (auto& entry : rows[i]) {
+            if (entry.distance - bound > local.q) {
+              break;
+            }
+            size_t j = slot_of[entry.node];
+            if (j == dead) {
+              continue;
+            }
+            Best candidate{ distances(i, j) - (row_sum[i] + row_sum[j]) * scale, std::min(i, j), std::max(i, j) };
+            if (candidate < local) {
+              local = candidate;
+            }
+          }
+        }
+        std::lock_guard<std::mutex> lock{ mutex };
+        if (local < best) {
+          best = local;
+        }
+      });
+
+      size_t a = best.i;
+      size_t b = best.j;
+      double d_ab = distances(a, b);
+      double length_a = d_ab / 2 + (row_sum[a] - row_sum[b]) * scale / 2;
+      size_t joined = tree.add_node({ { node[a], length_a }, { node[b], d_ab - length_a } });
+
+      slot_of[node[a]] = dead;
+      slot_of[node[b]] = dead;
+      node[b] = dead;
+      rows[b] = {};
+      remaining--;
+      row_sum[a] = 0.0;
+      for (size_t c = 0; c < n; c++) {
+        if (c == a || node[c] == dead) {
+          continue;
+        }
+        double d_c = (distances(a, c) + distances(b, c) - d_ab) / 2;
+        row_sum[c] += d_c - distances(a, c) - distances(b, c);
+        row_sum[a] += d_c;
+        distances(a, c) = d_c;
+        distances(c, a) = d_c;
+      }
+      node[a] = joined;
+      slot_of[joined] = a;
+      sort_row(a, 0);
+
+      // Drops the entries of joined nodes once half of the rows have gone.
+      if (remaining * 2 < live_at_compaction) {
+        live_at_compaction = remaining;
+        in_parallel(n, [&](size_t start, size_t stop) {
+          for (size_t i = start; i < stop; i++) {
+            rows[i].erase(std::remove_if(rows[i].begin(), rows[i].end(),
+              [&](const Entry& entry) { return slot_of[entry.node] == dead; }), rows[i].end());
+          }
+        });
+      }
+    }
+
+    std::vector<size_t> last{};
+    for (size_t i = 0; i < n; i++) {
+      if (node[i] != dead) {
+        last.push_back(i);
+      }
+    }
+    size_t x = last[0], y = last[1], z = last[2];
+    tree.add_node({
+      { node[x], (distances(x, y) + distances(x, z) - distances(y, z)) / 2 },
+      { node[y], (distances(x, y) + distances(y, z) - distances(x, z)) / 2 },
+      { node[z], (distances(x, z) + distances(y, z) - distances(x, y)) / 2 } });
+    return tree;
+  }
+
+  Tree upgma(matrix_t distances) {
+    size_t n = distances.rows();
+    symmetrise(distances);
+    Tree tree = leaves(n);
+    std::vector<size_t> node(n);
+    std::vector<double> cluster_size(n, 1.0);
+    std::vector<double> height(2 * n, 0.0);
+    // Live slots, unordered.
+    std::vector<size_t> live(n);
+    for (size_t i = 0; i < n; i++) {
+      node[i] = i;
+      live[i] = i;
+    }
+
+    std::vector<size_t> chain{};
+    while (live.size() > 1) {
+      if (chain.empty()) {
+        chain.push_back(live[0]);
+      }
+      size_t a = chain.back();
+      // Ties go to the previous element of the chain, which guarantees progress.
+      size_t previous = chain.size() > 1 ? chain[chain.size() - 2] : dead;
+      size_t nearest = previous;
+      double nearest_distance = previous == dead ? std::numeric_limits<double>::infinity() : distances(a, previous);
+      for (auto c : live) {
+        if (c != a && distances(a, c) < nearest_distance) {
+          nearest = c;
+          nearest_distance = distances(a, c);
+        }
+      }
+      if (nearest != previous) {
+        chain.push_back(nearest);
+        continue;
+      }
+
+      // a and b are reciprocal nearest neighbours, which UPGMA would join at some point anyway.
+      size_t b = previous;
+      chain.resize(chain.size() - 2);
+      double joined_height = nearest_distance / 2;
+      size_t joined = tree.add_node({ { node[a], joined_height - height[node[a]] }, { node[b], joined_height - height[node[b]] } });
+      height[joined] = joined_height;
+      double size_a = cluster_size[a], size_b = cluster_size[b];
+      for (auto c : live) {
+        if (c != a && c != b) {
+          double d_c = (size_a * distances(a, c) + size_b * distances(b, c)) / (size_a + size_b);
+          distances(a, c) = d_c;
+          distances(c, a) = d_c;
+        }
+      }
+      cluster_size[a] = size_a + size_b;
+      node[a] = joined;
+      live.erase(std::find(live.begin(), live.end(), b));
+    }
+    return tree;
+  }
+
+  Tree build(matrix_t distances, Method method, size_t requested_cores = 1) {
+    if (method == Method::method_upgma) {
+      return upgma(std::move(distances));
+    }
+    return neighbour_joining(std::move(distances), requested_cores);
+  }
+
+  // Quotes names with characters that Newick reserves.
+  std::string newick_label(const std::string& name) {
+    if (name.find_first_of(" ()[]':;,\t") == std::string::npos) {
+      return name;
+    }
+    std::string quoted = "'";
+    for (auto c : name) {
+      quoted += c == '\'' ? std::string("''") : std::string(1, c);
+    }
+    return quoted + "'";
+  }
+
+  // Iterative, as the trees of large collections can be deeper than the stack allows to recurse.
+  void write_newick(std::ostream& os, const Tree& tree, const std::vector<std::string>& names) {
+    struct Frame {
+      size_t node;
+      size_t next_child;
+      double length;
+    };
+    if (tree.children.empty()) {
+      os << ";\n";
+      return;
+    }
+    os << std::setprecision(10);
+    std::vector<Frame> stack{ { tree.root(), 0, 0.0 } };
+    while (!stack.empty()) {
+      auto& frame = stack.back();
+      auto& children = tree.children[frame.node];
+      if (children.empty() || frame.next_child == children.size()) {
+        if (children.empty()) {
+          os << newick_label(frame.node < names.size() ? names[frame.node] : std::to_string(frame.node));
+        }
+        else {
+          os << ")";
+        }
+        if (stack.size() > 1) {
+          os << ":" << frame.length;
+        }
+        stack.pop_back();
+        continue;
+      }
+      os << (frame.next_child == 0 ? "(" : ",");
+      auto [child, length] = children[frame.next_child++];
+      stack.push_back({ child, 0, length });
+    }
+    os << ";\n";
+  }
+}
@@ -5,25 +5,47 @@
 #include <limits.h>
 #include <exception>
 #include <algorithm>
-#include <execution>
 #include <math.h>
 #include <Eigen/Core>
 
 #include "kmer.hpp"
 #include "read_in_kmer.hpp"
 #include "global_aliases.hpp"
+#include "perf_report.hpp"
+#include "trace.hpp"
+#include "cluster_arena.hpp"
+#include "bundle.hpp"
 #include "unordered_dense.h"
 
+#include "vlmc_containers/construction.hpp"
 #include "vlmc_containers/veb_array.hpp"
 #include "vlmc_containers/eytzinger_array.hpp"
 #include "vlmc_containers/b_tree_array.hpp"
+#include "vlmc_containers/s_tree_array.hpp"
+#include "vlmc_containers/quantized_array.hpp"
+#include "vlmc_containers/rank_bitvector.hpp"
+#include "vlmc_containers/context_trie.hpp"
+#include "vlmc_containers/bloom_filter.hpp"
 
 namespace vlmc_container {
   using RI_Kmer = kmers::RI_Kmer;
 
   int load_VLMCs_from_file(const std::filesystem::path& path_to_bintree, eigenx_t& cached_context,
     const std::function<void(const RI_Kmer& kmer)> f, const size_t background_order = 0) {
-    std::ifstream ifs(path_to_bintree, std::ios::binary);
+    perf::Phase_Timer timer{ perf::Phase::phase_parse };
+    trace::Scope span{ "file_load" };
+    // Members of a bundle are read from its mapping.
+    auto member = bundle::find_member(path_to_bintree);
+    std::ifstream file{};
+    bundle::Memory_Buffer buffer{};
+    std::istream memory{ &buffer };
+    if (member) {
+      buffer.set(*member);
+    }
+    else {
+      file.open(path_to_bintree, std::ios::binary);
+    }
+    std::istream& ifs = member ? memory : file;
     cereal::BinaryInputArchive archive(ifs);
     kmers::VLMCKmer input_kmer{};
 
@@ -32,8 +54,10 @@ namespace vlmc_container {
       offset_to_remove += std::pow(4, i);
     }
 
+    unsigned long nr_kmers = 0;
     while (ifs.peek() != EOF) {
       archive(input_kmer);
+      nr_kmers++;
       RI_Kmer ri_kmer{ input_kmer };
       if (input_kmer.length <= background_order) {
         if (input_kmer.length + 1 > background_order) {
@@ -48,11 +72,77 @@ namespace vlmc_container {
         f(ri_kmer);
       }
     }
-    ifs.close();
+    perf::count(perf::Counter::kmers_loaded, nr_kmers);
 
     return offset_to_remove;
   }
 
+  std::vector<int> keys_of(const std::vector<RI_Kmer>& kmers) {
+    std::vector<int> keys(kmers.size());
+    for (size_t i = 0; i < kmers.size(); i++) {
+      keys[i] = kmers[i].integer_rep;
+    }
+    return keys;
+  }
+
+  // Squared norm of the probabilities of all kmers, which metrics that count unmatched contexts finalise with.
+  acc_t squared_norm_of(const std::vector<RI_Kmer>& kmers) {
+    acc_t sum = 0.0;
+    for (auto& kmer : kmers) {
+      for (int x = 0; x < 4; x++) {
+        sum += acc_t(kmer.next_char_prob[x]) * kmer.next_char_prob[x];
+      }
+    }
+    return sum;
+  }
+
+  // Kmers of a VLMC divided by the square root of their background probabilities, and their squared norm.
+  struct Normalised_Kmers {
+    std::vector<RI_Kmer> kmers{};
+    acc_t squared_norm = 0.0;
+  };
+
+  // Loads the kmers longer than the background order, sorted by key unless sorted is false, and normalises them.
+  Normalised_Kmers load_normalised(const std::filesystem::path& path_to_bintree, const size_t background_order,
+    size_t nr_threads = 1, bool sorted = true) {
+    Normalised_Kmers loaded{};
+    // cached_context : pointer to array which for each A, C, T, G has the next char probs
+    eigenx_t cached_context((int)std::pow(4, background_order), 4);
+
+    auto fun = [&](const RI_Kmer& kmer) { loaded.kmers.push_back(kmer); };
+
+    int offset_to_remove = load_VLMCs_from_file(path_to_bintree, cached_context, fun, background_order);
+
+    if (sorted) {
+      perf::Phase_Timer timer{ perf::Phase::phase_sort };
+      construction::sort_kmers(loaded.kmers, nr_threads);
+    }
+    perf::Phase_Timer timer{ perf::Phase::phase_background };
+    for (auto& kmer : loaded.kmers) {
+      int background_idx = kmer.background_order_index(kmer.integer_rep, background_order);
+      int offset = background_idx - offset_to_remove;
+      for (int x = 0; x < 4; x++) {
+        kmer.next_char_prob[x] *= 1.0 / std::sqrt(cached_context(offset, x));
+      }
+    }
+    loaded.squared_norm = squared_norm_of(loaded.kmers);
+    return loaded;
+  }
+
+  // Membership filter of the keys, empty unless '--filter-fpr' is given. The words come from the arena if there is one.
+  bloom::Blocked_Bloom build_filter(const std::vector<int>& keys, cluster_arena::Arena* arena = nullptr) {
+    if (bloom::false_positive_rate <= 0.0) {
+      return {};
+    }
+    uint64_t* storage = nullptr;
+    if (arena != nullptr) {
+      storage = arena->allocate<uint64_t>(size_t(bloom::block_words) * bloom::Blocked_Bloom::blocks(keys.size(), bloom::false_positive_rate));
+    }
+    bloom::Blocked_Bloom filter{ keys, bloom::false_positive_rate, storage };
+    perf::count(perf::Counter::filter_bytes, filter.bytes());
+    return filter;
+  }
+
   /*
     Storing Kmers in a sorted vector.
   */
@@ -60,25 +150,16 @@ namespace vlmc_container {
 
   public:
     std::vector<RI_Kmer> container{};
+    // Squared norm of all kmers, from squared_norm_of.
+    acc_t squared_norm = 0.0;
     VLMC_sorted_vector() = default;
     ~VLMC_sorted_vector() = default;
 
-    VLMC_sorted_vector(const std::filesystem::path& path_to_bintree, const size_t background_order = 0, bool use_new = false) {
-      eigenx_t cached_context((int)std::pow(4, background_order), 4);
-
-      auto fun = [&](const RI_Kmer& kmer) { push(kmer); };
-
-      int offset_to_remove = load_VLMCs_from_file(path_to_bintree, cached_context, fun, background_order);
-
-      std::sort(std::execution::seq, container.begin(), container.end());
-      for (size_t i = 0; i < size(); i++) {
-        RI_Kmer kmer = get(i);
-        int background_idx = kmer.background_order_index(kmer.integer_rep, background_order);
-        int offset = background_idx - offset_to_remove;
-        for (int x = 0; x < 4; x++) {
-          get(i).next_char_prob[x] *= 1.0 / std::sqrt(cached_context(offset, x));
-        }
-      }
+    VLMC_sorted_vector(const std::filesystem::path& path_to_bintree, const size_t background_order = 0, bool use_new = false,
+      size_t nr_threads = 1) {
+      auto loaded = load_normalised(path_to_bintree, background_order, nr_threads);
+      container = std::move(loaded.kmers);
+      squared_norm = loaded.squared_norm;
     }
 
     size_t size() const { return container.size(); }
@@ -91,13 +172,16 @@ namespace vlmc_container {
     RI_Kmer& get(const int i) { return container[i]; }
   };
 
-  void iterate_kmers(VLMC_sorted_vector& left_kmers, VLMC_sorted_vector& right_kmers, const std::function<void(const RI_Kmer& left_kmer, const RI_Kmer& right_kmer)>& f) {
+  template <typename F>
+  void iterate_kmers(VLMC_sorted_vector& left_kmers, VLMC_sorted_vector& right_kmers, F&& f) {
     auto right_it = right_kmers.begin();
     auto right_end = right_kmers.end();
     auto left_it = left_kmers.begin();
     auto left_end = left_kmers.end();
+    unsigned long nr_probes = 0;
 
     while (left_it != left_end && right_it != right_end) {
+      nr_probes++;
       auto left_kmer = *left_it;
       auto right_kmer = *right_it;
       if (left_kmer == right_kmer) {
@@ -111,6 +195,7 @@ namespace vlmc_container {
       else
         ++right_it;
     }
+    perf::count(perf::Counter::probes, nr_probes);
   }
 
   /*
@@ -120,6 +205,8 @@ namespace vlmc_container {
 
   public:
     ankerl::unordered_dense::map<int, RI_Kmer> container{};
+    bloom::Blocked_Bloom filter{};
+    acc_t squared_norm = 0.0;
     VLMC_hashmap() = default;
     ~VLMC_hashmap() = default;
 
@@ -131,13 +218,26 @@ namespace vlmc_container {
 
       int offset_to_remove = load_VLMCs_from_file(path_to_bintree, cached_context, fun, background_order);
 
-      for (auto& [i_rep, kmer] : container) {
-        int background_idx = kmer.background_order_index(kmer.integer_rep, background_order);
-        int offset = background_idx - offset_to_remove;
-        for (int x = 0; x < 4; x++) {
-          kmer.next_char_prob[x] *= 1.0 / std::sqrt(cached_context(offset, x));
+      {
+        perf::Phase_Timer timer{ perf::Phase::phase_background };
+        for (auto& [i_rep, kmer] : container) {
+          int background_idx = kmer.background_order_index(kmer.integer_rep, background_order);
+          int offset = background_idx - offset_to_remove;
+          for (int x = 0; x < 4; x++) {
+            kmer.next_char_prob[x] *= 1.0 / std::sqrt(cached_context(offset, x));
+            squared_norm += acc_t(kmer.next_char_prob[x]) * kmer.next_char_prob[x];
+          }
         }
       }
+      if (bloom::false_positive_rate > 0.0) {
+        perf::Phase_Timer timer{ perf::Phase::phase_layout };
+        std::vector<int> keys{};
+        keys.reserve(container.size());
+        for (auto& [i_rep, kmer] : container) {
+          keys.push_back(i_rep);
+        }
+        filter = build_filter(keys);
+      }
     }
 
     size_t size() const { return container.size(); }
@@ -147,153 +247,238 @@ namespace vlmc_container {
     RI_Kmer& get(const int i) { return container[i]; }
   };
 
-  void iterate_kmers(VLMC_hashmap& left_kmers, VLMC_hashmap& right_kmers, const std::function<void(const RI_Kmer& left_kmer, const RI_Kmer& right_kmer)>& f) {
+  template <typename F>
+  void iterate_kmers(VLMC_hashmap& left_kmers, VLMC_hashmap& right_kmers, F&& f) {
+    unsigned long nr_rejected = 0;
     for (auto& [i_rep, left_kmer] : left_kmers.container) {
+      if (!right_kmers.filter.may_contain(i_rep)) {
+        nr_rejected++;
+        continue;
+      }
       auto res = right_kmers.container.find(i_rep);
       if (res != right_kmers.container.end()) {
         auto right_kmer = res->second;
         f(left_kmer, right_kmer);
       }
     }
+    perf::count(perf::Counter::probes, left_kmers.size() - nr_rejected);
+    perf::count(perf::Counter::filter_rejects, nr_rejected);
+  }
+
+  /*
+    Probes right_kmers for the keys of the nr_left kmers in left, a batch of
+    keys at a time. Keys rejected by the filter of right_kmers are left out of
+    the batches.
+  */
+  template <typename VC, typename F>
+  void iterate_batched(RI_Kmer* left, int nr_left, VC& right_kmers, F&& f) {
+    constexpr int batch_size = 64;
+    int keys[batch_size];
+    int lefts[batch_size];
+    unsigned long nr_rejected = 0;
+    for (int start = 0; start < nr_left; start += batch_size) {
+      int stop = std::min(start + batch_size, nr_left);
+      int batch = 0;
+      for (int k = start; k < stop; k++) {
+        keys[batch] = left[k].integer_rep;
+        lefts[batch] = k;
+        bool keep = right_kmers.filter.may_contain(keys[batch]);
+        batch += keep;
+        nr_rejected += !keep;
+      }
+      right_kmers.get_batch(keys, batch, [&](int k, RI_Kmer& right_kmer) { f(left[lefts[k]], right_kmer); });
+    }
+    perf::count(perf::Counter::probes, nr_left - nr_rejected);
+    perf::count(perf::Counter::filter_rejects, nr_rejected);
   }
 
   class VLMC_Veb {
 
   public:
-    array::Veb_array* veb;
+    // View of the layout in the cluster arena.
+    array::Veb_array veb{};
+    bloom::Blocked_Bloom filter{};
+    acc_t squared_norm = 0.0;
     VLMC_Veb() = default;
     ~VLMC_Veb() = default;
 
-    VLMC_Veb(const std::filesystem::path& path_to_bintree, const size_t background_order = 0) {
-      // cached_context : pointer to array which for each A, C, T, G has the next char probs
-      eigenx_t cached_context((int)std::pow(4, background_order), 4);
-
-      auto tmp_container = std::vector<RI_Kmer>{};
-      auto fun = [&](const RI_Kmer& kmer) { tmp_container.push_back(kmer); };
-
-      int offset_to_remove = load_VLMCs_from_file(path_to_bintree, cached_context, fun, background_order);
-
-      std::sort(std::execution::seq, tmp_container.begin(), tmp_container.end());
-      for (auto& kmer : tmp_container) {
-        int background_idx = kmer.background_order_index(kmer.integer_rep, background_order);
-        int offset = background_idx - offset_to_remove;
-        for (int x = 0; x < 4; x++) {
-          kmer.next_char_prob[x] *= 1.0 / std::sqrt(cached_context(offset, x));
-        }
-      }
-      veb = new array::Veb_array(tmp_container);
+    VLMC_Veb(const std::filesystem::path& path_to_bintree, const size_t background_order, cluster_arena::Arena& arena,
+      size_t nr_threads = 1) {
+      auto [tmp_container, norm] = load_normalised(path_to_bintree, background_order, nr_threads);
+      squared_norm = norm;
+      perf::Phase_Timer timer{ perf::Phase::phase_layout };
+      filter = build_filter(keys_of(tmp_container), &arena);
+      auto* storage = arena.allocate<RI_Kmer>(array::Veb_array::storage_size(tmp_container.size()));
+      veb = array::Veb_array(tmp_container, storage, nr_threads);
     }
 
-    size_t size() const { return veb->n + 1; }
+    size_t size() const { return veb.n; }
 
     RI_Kmer& get(const int i) {
-      return veb->get_from_array(i);
+      return veb.get_from_array(i);
     }
-  };
 
-  void iterate_kmers(VLMC_Veb& left_kmers, VLMC_Veb& right_kmers, const std::function<void(const RI_Kmer& left_kmer, const RI_Kmer& right_kmer)>& f) {
-    int i = 0;
-    while (i < left_kmers.veb->n) {
-      RI_Kmer& left_kmer = left_kmers.veb->a[i];
-      RI_Kmer& right_kmer = right_kmers.get(left_kmer.integer_rep);
-      if (left_kmer == right_kmer) {
-        f(left_kmer, right_kmer);
+    /*
+      Looks up count keys, batch_size at a time, and calls f(k, kmer) for every
+      key i_reps[k] that is present.
+    */
+    template <typename F>
+    void get_batch(const int* i_reps, int count, F&& f) {
+      int indices[array::Veb_array::batch_size];
+      for (int start = 0; start < count; start += array::Veb_array::batch_size) {
+        int batch = std::min(array::Veb_array::batch_size, count - start);
+        veb.search_batch(i_reps + start, indices, batch);
+        for (int k = 0; k < batch; k++) {
+          if (indices[k] < veb.n && veb.a[indices[k]].integer_rep == i_reps[start + k]) {
+            f(start + k, veb.a[indices[k]]);
+          }
+        }
       }
-      i++;
     }
+  };
+
+  template <typename F>
+  void iterate_kmers(VLMC_Veb& left_kmers, VLMC_Veb& right_kmers, F&& f) {
+    iterate_batched(left_kmers.veb.a, left_kmers.veb.n, right_kmers, f);
   }
 
   class VLMC_Eytzinger {
 
   public:
-    array::Ey_array* arr;
+    array::Ey_array arr{};
+    bloom::Blocked_Bloom filter{};
+    acc_t squared_norm = 0.0;
     VLMC_Eytzinger() = default;
     ~VLMC_Eytzinger() = default;
 
-    VLMC_Eytzinger(const std::filesystem::path& path_to_bintree, const size_t background_order = 0) {
-      // cached_context : pointer to array which for each A, C, T, G has the next char probs
-      eigenx_t cached_context((int)std::pow(4, background_order), 4);
-
-      auto tmp_container = std::vector<RI_Kmer>{};
-      auto fun = [&](const RI_Kmer& kmer) { tmp_container.push_back(kmer); };
-
-      int offset_to_remove = load_VLMCs_from_file(path_to_bintree, cached_context, fun, background_order);
-
-      std::sort(std::execution::seq, tmp_container.begin(), tmp_container.end());
-      for (auto& kmer : tmp_container) {
-        int background_idx = kmer.background_order_index(kmer.integer_rep, background_order);
-        int offset = background_idx - offset_to_remove;
-        for (int x = 0; x < 4; x++) {
-          kmer.next_char_prob[x] *= 1.0 / std::sqrt(cached_context(offset, x));
-        }
-      }
-      arr = new array::Ey_array(tmp_container);
+    VLMC_Eytzinger(const std::filesystem::path& path_to_bintree, const size_t background_order, cluster_arena::Arena& arena,
+      size_t nr_threads = 1) {
+      auto [tmp_container, norm] = load_normalised(path_to_bintree, background_order, nr_threads);
+      squared_norm = norm;
+      perf::Phase_Timer timer{ perf::Phase::phase_layout };
+      filter = build_filter(keys_of(tmp_container), &arena);
+      auto* storage = arena.allocate<RI_Kmer>(array::Ey_array::storage_size(tmp_container.size()));
+      arr = array::Ey_array(tmp_container, storage, nr_threads);
     }
 
-    size_t size() const { return arr->size + 1; }
+    size_t size() const { return arr.size; }
 
     RI_Kmer& get(const int i) {
       ;
-      return arr->get_from_array(i);
+      return arr.get_from_array(i);
     }
-  };
 
-  void iterate_kmers(VLMC_Eytzinger& left_kmers, VLMC_Eytzinger& right_kmers, const std::function<void(const RI_Kmer& left_kmer, const RI_Kmer& right_kmer)>& f) {
-    int i = 0;
-    while (i <= left_kmers.arr->size) {
-      RI_Kmer& left_kmer = left_kmers.arr->ey_sorted_kmers[i];
-      RI_Kmer& right_kmer = right_kmers.get(left_kmer.integer_rep);
-      if (left_kmer == right_kmer) {
-        f(left_kmer, right_kmer);
+    // Same as VLMC_Veb::get_batch.
+    template <typename F>
+    void get_batch(const int* i_reps, int count, F&& f) {
+      int indices[array::Ey_array::batch_size];
+      for (int start = 0; start < count; start += array::Ey_array::batch_size) {
+        int batch = std::min(array::Ey_array::batch_size, count - start);
+        arr.search_batch(i_reps + start, indices, batch);
+        for (int k = 0; k < batch; k++) {
+          if (arr.ey_sorted_kmers[indices[k]].integer_rep == i_reps[start + k]) {
+            f(start + k, arr.ey_sorted_kmers[indices[k]]);
+          }
+        }
       }
-      i++;
     }
+  };
+
+  template <typename F>
+  void iterate_kmers(VLMC_Eytzinger& left_kmers, VLMC_Eytzinger& right_kmers, F&& f) {
+    iterate_batched(left_kmers.arr.ey_sorted_kmers, left_kmers.arr.size + 1, right_kmers, f);
   }
 
   class VLMC_B_tree {
   public:
-    array::B_Tree* arr;
+    array::B_Tree arr{};
+    bloom::Blocked_Bloom filter{};
+    acc_t squared_norm = 0.0;
     VLMC_B_tree() = default;
     ~VLMC_B_tree() = default;
 
-    VLMC_B_tree(const std::filesystem::path& path_to_bintree, const size_t background_order = 0) {
-      // cached_context : pointer to array which for each A, C, T, G has the next char probs
-      eigenx_t cached_context((int)std::pow(4, background_order), 4);
+    VLMC_B_tree(const std::filesystem::path& path_to_bintree, const size_t background_order, cluster_arena::Arena& arena,
+      size_t nr_threads = 1) {
+      auto [tmp_container, norm] = load_normalised(path_to_bintree, background_order, nr_threads);
+      squared_norm = norm;
+      perf::Phase_Timer timer{ perf::Phase::phase_layout };
+      filter = build_filter(keys_of(tmp_container), &arena);
+      auto* storage = arena.allocate<RI_Kmer>(array::B_Tree::storage_size(tmp_container.size()));
+      arr = array::B_Tree(tmp_container, storage, nr_threads);
+    }
 
-      auto tmp_container = std::vector<RI_Kmer>{};
-      auto fun = [&](const RI_Kmer& kmer) { tmp_container.push_back(kmer); };
+    size_t size() const { return arr.size; }
 
-      int offset_to_remove = load_VLMCs_from_file(path_to_bintree, cached_context, fun, background_order);
+    RI_Kmer& get(const int i) {
+      ;
+      return arr.get_from_array(i);
+    }
 
-      std::sort(std::execution::seq, tmp_container.begin(), tmp_container.end());
-      for (auto& kmer : tmp_container) {
-        int background_idx = kmer.background_order_index(kmer.integer_rep, background_order);
-        int offset = background_idx - offset_to_remove;
-        for (int x = 0; x < 4; x++) {
-          kmer.next_char_prob[x] *= 1.0 / std::sqrt(cached_context(offset, x));
+    // Same as VLMC_Veb::get_batch.
+    template <typename F>
+    void get_batch(const int* i_reps, int count, F&& f) {
+      int indices[array::B_Tree::batch_size];
+      for (int start = 0; start < count; start += array::B_Tree::batch_size) {
+        int batch = std::min(array::B_Tree::batch_size, count - start);
+        arr.search_batch(i_reps + start, indices, batch);
+        for (int k = 0; k < batch; k++) {
+          if (indices[k] < arr.size && arr.a[indices[k]].integer_rep == i_reps[start + k]) {
+            f(start + k, arr.a[indices[k]]);
+          }
         }
       }
-      arr = new array::B_Tree(tmp_container);
     }
+  };
 
-    size_t size() const { return arr->size + 1; }
+  template <typename F>
+  void iterate_kmers(VLMC_B_tree& left_kmers, VLMC_B_tree& right_kmers, F&& f) {
+    iterate_batched(left_kmers.arr.a, left_kmers.arr.size, right_kmers, f);
+  }
+
+  class VLMC_S_tree {
+  public:
+    array::S_Tree arr{};
+    bloom::Blocked_Bloom filter{};
+    acc_t squared_norm = 0.0;
+    VLMC_S_tree() = default;
+    ~VLMC_S_tree() = default;
+
+    VLMC_S_tree(const std::filesystem::path& path_to_bintree, const size_t background_order, cluster_arena::Arena& arena,
+      size_t nr_threads = 1) {
+      auto [tmp_container, norm] = load_normalised(path_to_bintree, background_order, nr_threads);
+      squared_norm = norm;
+      perf::Phase_Timer timer{ perf::Phase::phase_layout };
+      filter = build_filter(keys_of(tmp_container), &arena);
+      auto* keys = arena.allocate<int>(array::S_Tree::storage_size(tmp_container.size()));
+      auto* kmers = arena.allocate<RI_Kmer>(tmp_container.size());
+      arr = array::S_Tree(tmp_container, keys, kmers);
+    }
+
+    size_t size() const { return arr.size; }
 
     RI_Kmer& get(const int i) {
-      ;
-      return arr->get_from_array(i);
+      return arr.get_from_array(i);
     }
-  };
 
-  void iterate_kmers(VLMC_B_tree& left_kmers, VLMC_B_tree& right_kmers, const std::function<void(const RI_Kmer& left_kmer, const RI_Kmer& right_kmer)>& f) {
-    int i = 0;
-    while (i < left_kmers.arr->size) {
-      RI_Kmer& left_kmer = left_kmers.arr->a[i];
-      RI_Kmer& right_kmer = right_kmers.get(left_kmer.integer_rep);
-      if (left_kmer == right_kmer) {
-        f(left_kmer, right_kmer);
+    // Same as VLMC_Veb::get_batch.
+    template <typename F>
+    void get_batch(const int* i_reps, int count, F&& f) {
+      int indices[array::S_Tree::batch_size];
+      for (int start = 0; start < count; start += array::S_Tree::batch_size) {
+        int batch = std::min(array::S_Tree::batch_size, count - start);
+        arr.search_batch(i_reps + start, indices, batch);
+        for (int k = 0; k < batch; k++) {
+          if (indices[k] < arr.size && arr.kmers[indices[k]].integer_rep == i_reps[start + k]) {
+            f(start + k, arr.kmers[indices[k]]);
+          }
+        }
       }
-      i++;
     }
+  };
+
+  template <typename F>
+  void iterate_kmers(VLMC_S_tree& left_kmers, VLMC_S_tree& right_kmers, F&& f) {
+    iterate_batched(left_kmers.arr.kmers, left_kmers.arr.size, right_kmers, f);
   }
 
   /*
@@ -323,26 +508,17 @@ namespace vlmc_container {
     std::vector<RI_Kmer> container{};
     std::vector<Min_max_node> summary{};
     int place_in_summary = 0;
+    acc_t squared_norm = 0.0;
     VLMC_sorted_search() = default;
     ~VLMC_sorted_search() = default;
 
-    VLMC_sorted_search(const std::filesystem::path& path_to_bintree, const size_t background_order = 0, bool use_new = false) {
-      eigenx_t cached_context((int)std::pow(4, background_order), 4);
-
-      auto fun = [&](const RI_Kmer& kmer) { push(kmer); };
-
-      int offset_to_remove = load_VLMCs_from_file(path_to_bintree, cached_context, fun, background_order);
-
-      std::sort(std::execution::seq, container.begin(), container.end());
-      for (size_t i = 0; i < size(); i++) {
-        RI_Kmer kmer = get(i);
-        int background_idx = kmer.background_order_index(kmer.integer_rep, background_order);
-        int offset = background_idx - offset_to_remove;
-        for (int x = 0; x < 4; x++) {
-          get(i).next_char_prob[x] *= 1.0 / std::sqrt(cached_context(offset, x));
-        }
-      }
+    VLMC_sorted_search(const std::filesystem::path& path_to_bintree, const size_t background_order = 0, bool use_new = false,
+      size_t nr_threads = 1) {
+      auto loaded = load_normalised(path_to_bintree, background_order, nr_threads);
+      container = std::move(loaded.kmers);
+      squared_norm = loaded.squared_norm;
       // Build summary
+      perf::Phase_Timer timer{ perf::Phase::phase_layout };
       if (container.size() > 0) {
         skip_size = std::ceil(std::log2(container.size()));
         if (skip_size == 0) {
@@ -366,18 +542,93 @@ namespace vlmc_container {
 
     RI_Kmer& get(const int i) { return container[i]; }
 
+    // Galloping search from the current block for the first block with max >= i_rep.
     int find_block_start(int i_rep) {
-      for (int i = place_in_summary; i < summary.size(); i++) {
-        if (i_rep <= summary[i].max) {
-          place_in_summary = i;
-          return summary[i].block_start;
-        }
+      int n = summary.size();
+      int bound = 1;
+      while (place_in_summary + bound < n && summary[place_in_summary + bound].max < i_rep) {
+        bound *= 2;
       }
-      return container.size();
+      auto first = summary.begin() + place_in_summary + bound / 2;
+      auto last = summary.begin() + std::min(place_in_summary + bound, n);
+      int i = std::partition_point(first, last, [i_rep](const Min_max_node& node) { return node.max < i_rep; }) - summary.begin();
+      if (i == n) {
+        return container.size();
+      }
+      perf::count(perf::Counter::skipped_blocks, i - place_in_summary);
+      place_in_summary = i;
+      return summary[i].block_start;
     }
   };
 
-  void iterate_kmers(VLMC_sorted_search& left_kmers, VLMC_sorted_search& right_kmers, const std::function<void(const RI_Kmer& left_kmer, const RI_Kmer& right_kmer)>& f) {
+  // Size ratios from which iterate_kmers switches from merging to galloping and to binary search.
+  constexpr size_t gallop_ratio = 8;
+  constexpr size_t binary_search_ratio = 256;
+
+  // Key of a kmer or of a plain key, so that the searches below run on sorted kmers and on sorted keys.
+  inline int key_of(const RI_Kmer& kmer) { return kmer.integer_rep; }
+  inline int key_of(int key) { return key; }
+
+  // First index in [lo, hi) with a key >= i_rep, by exponential search from lo.
+  template <typename T>
+  size_t gallop(const T* sorted, size_t lo, size_t hi, int i_rep) {
+    size_t bound = 1;
+    while (lo + bound < hi && key_of(sorted[lo + bound]) < i_rep) {
+      bound *= 2;
+    }
+    return std::partition_point(sorted + lo + bound / 2, sorted + std::min(lo + bound, hi),
+      [i_rep](const T& element) { return key_of(element) < i_rep; }) - sorted;
+  }
+
+  template <typename T>
+  size_t binary_search(const T* sorted, size_t lo, size_t hi, int i_rep) {
+    return std::partition_point(sorted + lo, sorted + hi, [i_rep](const T& element) { return key_of(element) < i_rep; }) - sorted;
+  }
+
+  /*
+    Intersection when 'large' is much bigger than 'small': every key of small is
+    searched for in the remainder of large, by galloping or, for very skewed
+    sizes, plain binary search. f is called as f(small_index, large_index).
+  */
+  template <typename T, typename F>
+  void skewed_intersection(const T* small, size_t small_size, const T* large, size_t large_size, bool use_binary_search, F&& f) {
+    size_t large_i = 0;
+    unsigned long nr_probes = 0;
+    for (size_t small_i = 0; small_i < small_size; small_i++) {
+      nr_probes++;
+      int i_rep = key_of(small[small_i]);
+      if (use_binary_search) {
+        large_i = binary_search(large, large_i, large_size, i_rep);
+      }
+      else {
+        large_i = gallop(large, large_i, large_size, i_rep);
+      }
+      if (large_i == large_size) {
+        break;
+      }
+      if (key_of(large[large_i]) == i_rep) {
+        f(small_i, large_i);
+        large_i++;
+      }
+    }
+    perf::count(perf::Counter::probes, nr_probes);
+  }
+
+  template <typename F>
+  void iterate_kmers(VLMC_sorted_search& left_kmers, VLMC_sorted_search& right_kmers, F&& f) {
+    if (left_kmers.size() * gallop_ratio <= right_kmers.size()) {
+      bool use_binary_search = left_kmers.size() * binary_search_ratio <= right_kmers.size();
+      skewed_intersection(left_kmers.container.data(), left_kmers.size(), right_kmers.container.data(), right_kmers.size(),
+        use_binary_search, [&](size_t left_i, size_t right_i) { f(left_kmers.get(left_i), right_kmers.get(right_i)); });
+      return;
+    }
+    if (right_kmers.size() * gallop_ratio <= left_kmers.size()) {
+      bool use_binary_search = right_kmers.size() * binary_search_ratio <= left_kmers.size();
+      skewed_intersection(right_kmers.container.data(), right_kmers.size(), left_kmers.container.data(), left_kmers.size(),
+        use_binary_search, [&](size_t right_i, size_t left_i) { f(left_kmers.get(left_i), right_kmers.get(right_i)); });
+      return;
+    }
+
     left_kmers.place_in_summary = 0;
     right_kmers.place_in_summary = 0;
 
@@ -385,8 +636,10 @@ namespace vlmc_container {
     auto right_i = 0;
     auto left_size = left_kmers.size();
     auto right_size = right_kmers.size();
+    unsigned long nr_probes = 0;
 
     while (left_i < left_size && right_i < right_size) {
+      nr_probes++;
       RI_Kmer& left_kmer = left_kmers.get(left_i);
       RI_Kmer& right_kmer = right_kmers.get(right_i);
       if (left_kmer == right_kmer) {
@@ -423,5 +676,236 @@ namespace vlmc_container {
         }
       }
     }
+    perf::count(perf::Counter::probes, nr_probes);
+  }
+
+  /*
+    Sorted keys with fixed point probabilities, see array::Quantized_Array. The
+    distances use the integer kernels through quantized_dot_norm, iterate_kmers
+    dequantizes and is only there for the generic code paths.
+  */
+  template <typename T>
+  class VLMC_quantized {
+  public:
+    array::Quantized_Array<T> arr{};
+    acc_t squared_norm = 0.0;
+    VLMC_quantized() = default;
+    ~VLMC_quantized() = default;
+
+    VLMC_quantized(const std::filesystem::path& path_to_bintree, const size_t background_order, cluster_arena::Arena& arena,
+      size_t nr_threads = 1) {
+      // The norm is taken from the quantized probabilities below.
+      auto tmp_container = load_normalised(path_to_bintree, background_order, nr_threads).kmers;
+      perf::Phase_Timer timer{ perf::Phase::phase_layout };
+      auto* keys = arena.allocate<int>(tmp_container.size());
+      auto* probs = arena.allocate<T>(4 * tmp_container.size());
+      arr = array::Quantized_Array<T>(tmp_container, keys, probs);
+      // From the quantized probabilities, as the matched contexts are, so that identical VLMCs leave no rest.
+      int64_t sum = 0;
+      for (size_t i = 0; i < 4 * arr.size; i++) {
+        sum += int64_t(arr.probs[i]) * arr.probs[i];
+      }
+      squared_norm = acc_t(sum * arr.scale * arr.scale);
+    }
+
+    size_t size() const { return arr.size; }
+
+    RI_Kmer get(const int i) const { return arr.kmer(i); }
+  };
+
+  template <typename VC>
+  constexpr bool is_quantized = false;
+  template <typename T>
+  constexpr bool is_quantized<VLMC_quantized<T>> = true;
+
+  // Containers that keep their kmers sorted by key in 'container'.
+  template <typename VC>
+  constexpr bool has_sorted_kmers = false;
+  template <>
+  constexpr bool has_sorted_kmers<VLMC_sorted_vector> = true;
+  template <>
+  constexpr bool has_sorted_kmers<VLMC_sorted_search> = true;
+
+  // Calls f(left_index, right_index) for every key in both sorted arrays, through skewed_intersection when the sizes are skewed.
+  template <typename F>
+  void iterate_keys(const int* left, int left_size, const int* right, int right_size, F&& f) {
+    int left_i = 0;
+    int right_i = 0;
+    unsigned long nr_probes = 0;
+
+    if (size_t(left_size) * gallop_ratio <= size_t(right_size)) {
+      skewed_intersection(left, left_size, right, right_size, size_t(left_size) * binary_search_ratio <= size_t(right_size),
+        [&](size_t small_i, size_t large_i) { f(int(small_i), int(large_i)); });
+      return;
+    }
+    if (size_t(right_size) * gallop_ratio <= size_t(left_size)) {
+      skewed_intersection(right, right_size, left, left_size, size_t(right_size) * binary_search_ratio <= size_t(left_size),
+        [&](size_t small_i, size_t large_i) { f(int(large_i), int(small_i)); });
+      return;
+    }
+
+    while (left_i < left_size && right_i < right_size) {
+      nr_probes++;
+      if (left[left_i] == right[right_i]) {
+        f(left_i, right_i);
+        ++left_i;
+        ++right_i;
+      }
+      else if (left[left_i] < right[right_i]) {
+        ++left_i;
+      }
+      else {
+        ++right_i;
+      }
+    }
+    perf::count(perf::Counter::probes, nr_probes);
+  }
+
+  template <typename T, typename F>
+  void iterate_indices(VLMC_quantized<T>& left_kmers, VLMC_quantized<T>& right_kmers, F&& f) {
+    iterate_keys(left_kmers.arr.keys, left_kmers.arr.size, right_kmers.arr.keys, right_kmers.arr.size, f);
+  }
+
+  template <typename T, typename F>
+  void iterate_kmers(VLMC_quantized<T>& left_kmers, VLMC_quantized<T>& right_kmers, F&& f) {
+    iterate_indices(left_kmers, right_kmers, [&](int left_i, int right_i) {
+      f(left_kmers.arr.kmer(left_i), right_kmers.arr.kmer(right_i));
+    });
+  }
+
+  // Integer dot product and norms over the matched contexts, the matches are gathered and handed to the kernel in batches.
+  template <typename T>
+  array::Int_dot_norm quantized_dot_norm(VLMC_quantized<T>& left_kmers, VLMC_quantized<T>& right_kmers, unsigned long& matched) {
+    constexpr int batch_size = 64;
+    int left_idx[batch_size];
+    int right_idx[batch_size];
+    int count = 0;
+    array::Int_dot_norm acc{};
+
+    iterate_indices(left_kmers, right_kmers, [&](int left_i, int right_i) {
+      left_idx[count] = left_i;
+      right_idx[count] = right_i;
+      if (++count == batch_size) {
+        array::dot_norm(left_kmers.arr, right_kmers.arr, left_idx, right_idx, count, acc);
+        matched += count;
+        count = 0;
+      }
+    });
+    array::dot_norm(left_kmers.arr, right_kmers.arr, left_idx, right_idx, count, acc);
+    matched += count;
+    return acc;
+  }
+
+  /*
+    Presence bitvector with a rank directory, see array::Rank_Bitvector. Two
+    dense VLMCs intersect by ANDing their blocks, a sparse one looks its keys
+    up in a dense one, and two sparse ones are merged like the quantized keys.
+  */
+  class VLMC_rank_bitvector {
+  public:
+    array::Rank_Bitvector arr{};
+    acc_t squared_norm = 0.0;
+    VLMC_rank_bitvector() = default;
+    ~VLMC_rank_bitvector() = default;
+
+    VLMC_rank_bitvector(const std::filesystem::path& path_to_bintree, const size_t background_order, cluster_arena::Arena& arena,
+      size_t nr_threads = 1) {
+      auto [tmp_container, norm] = load_normalised(path_to_bintree, background_order, nr_threads);
+      squared_norm = norm;
+      perf::Phase_Timer timer{ perf::Phase::phase_layout };
+      size_t nr_blocks = array::Rank_Bitvector::storage_blocks(tmp_container);
+      uint64_t* bits = nullptr;
+      uint32_t* ranks = nullptr;
+      int* keys = nullptr;
+      if (nr_blocks > 0) {
+        bits = arena.allocate<uint64_t>(nr_blocks * array::Rank_Bitvector::words_per_block);
+        ranks = arena.allocate<uint32_t>(nr_blocks);
+      }
+      else {
+        keys = arena.allocate<int>(tmp_container.size());
+      }
+      auto* kmers = arena.allocate<RI_Kmer>(tmp_container.size());
+      arr = array::Rank_Bitvector(tmp_container, bits, ranks, keys, kmers);
+    }
+
+    size_t size() const { return arr.size; }
+
+    RI_Kmer& get(const int i) { return arr.kmers[i]; }
+  };
+
+  // Looks up the keys of the sparse side in the dense side, f is called as f(sparse_index, dense_index).
+  template <typename F>
+  void iterate_sparse_dense(const array::Rank_Bitvector& sparse, const array::Rank_Bitvector& dense, F&& f) {
+    int start = std::lower_bound(sparse.keys, sparse.keys + sparse.size, dense.base) - sparse.keys;
+    unsigned long nr_probes = 0;
+    for (int i = start; i < sparse.size && sparse.keys[i] < dense.end_key(); i++) {
+      nr_probes++;
+      int dense_i = dense.find(sparse.keys[i]);
+      if (dense_i >= 0) {
+        f(i, dense_i);
+      }
+    }
+    perf::count(perf::Counter::probes, nr_probes);
+  }
+
+  template <typename F>
+  void iterate_indices(VLMC_rank_bitvector& left_kmers, VLMC_rank_bitvector& right_kmers, F&& f) {
+    auto& left = left_kmers.arr;
+    auto& right = right_kmers.arr;
+    if (left.dense && right.dense) {
+      perf::count(perf::Counter::probes, array::intersect_dense(left, right, f));
+    }
+    else if (right.dense) {
+      iterate_sparse_dense(left, right, f);
+    }
+    else if (left.dense) {
+      iterate_sparse_dense(right, left, [&](int right_i, int left_i) { f(left_i, right_i); });
+    }
+    else {
+      iterate_keys(left.keys, left.size, right.keys, right.size, f);
+    }
+  }
+
+  template <typename F>
+  void iterate_kmers(VLMC_rank_bitvector& left_kmers, VLMC_rank_bitvector& right_kmers, F&& f) {
+    iterate_indices(left_kmers, right_kmers, [&](int left_i, int right_i) {
+      f(left_kmers.arr.kmers[left_i], right_kmers.arr.kmers[right_i]);
+    });
+  }
+
+  /*
+    The context tree in depth first order, see array::Context_Trie. Two
+    VLMCs are intersected by walking both tries at once, skipping every
+    subtree that only one of them has.
+  */
+  class VLMC_context_trie {
+  public:
+    array::Context_Trie trie{};
+    acc_t squared_norm = 0.0;
+    VLMC_context_trie() = default;
+    ~VLMC_context_trie() = default;
+
+    VLMC_context_trie(const std::filesystem::path& path_to_bintree, const size_t background_order, cluster_arena::Arena& arena) {
+      auto [tmp_container, norm] = load_normalised(path_to_bintree, background_order, 1, false);
+      squared_norm = norm;
+      perf::Phase_Timer timer{ perf::Phase::phase_layout };
+      auto nodes = array::Context_Trie::build_nodes(tmp_container);
+      auto* node_storage = arena.allocate<array::Context_Trie::Node>(nodes.size());
+      auto* kmers = arena.allocate<RI_Kmer>(tmp_container.size());
+      trie = array::Context_Trie(tmp_container, nodes, node_storage, kmers);
+    }
+
+    size_t size() const { return trie.size; }
+
+    RI_Kmer& get(const int i) { return trie.kmers[i]; }
+  };
+
+  template <typename F>
+  void iterate_kmers(VLMC_context_trie& left_kmers, VLMC_context_trie& right_kmers, F&& f) {
+    auto& left = left_kmers.trie;
+    auto& right = right_kmers.trie;
+    perf::count(perf::Counter::probes, array::intersect_tries(left, right, [&](int left_i, int right_i) {
+      f(left.kmers[left_i], right.kmers[right_i]);
+    }));
   }
-}
\ No newline at end of file
+}
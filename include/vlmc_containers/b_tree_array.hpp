@@ -3,23 +3,28 @@
 #include <iostream>
 
 #include "read_in_kmer.hpp"
+#include "construction.hpp"
 #include <bits/stdc++.h>
 
 namespace array {
 	struct B_Tree {
 		int size;
-		const int block_size = 2; // 64 / sizeof(RI_Kmer)
+		static const int block_size = 2; // 64 / sizeof(RI_Kmer)
 		static const int B = 2;
-		alignas(64) std::vector<kmers::RI_Kmer> a;
+		static constexpr int batch_size = 16;
+		// Not owned, storage_size(size) kmers.
+		kmers::RI_Kmer* a;
 
 		B_Tree() = default;
 		~B_Tree() = default;
 
-		B_Tree(std::vector<kmers::RI_Kmer>& from_container) {
+		B_Tree(std::vector<kmers::RI_Kmer>& from_container, kmers::RI_Kmer* storage, size_t nr_threads = 1) {
 			size = from_container.size();
-			a.reserve(size + 1);
-			construct(from_container.begin(), 0);
+			a = storage;
+			construction::layout(from_container.data(), size, a, 0, nr_threads, [&](auto&& visit) { walk(size, visit); });
 		}
+
+		static size_t storage_size(size_t n) { return n + 1; }
 		static int child(unsigned c, int i) {
 			return (B + 1) * i + (c + 1) * B;
 		}
@@ -42,18 +47,34 @@ namespace array {
 			return branchy_inner_search<C - C / 2 - 1>(a, i + C / 2 + 1, x);
 		}
 
-		std::vector<kmers::RI_Kmer>::iterator construct(std::vector<kmers::RI_Kmer>::iterator a0, int i) {
-			if (i >= size)
-				return a0;
-
-			for (unsigned c = 0; c <= B; c++) {
-				// visit c'th child
-				a0 = construct(a0, child(c, i));
-				if (c < B && i + c < size) {
-					a[i + c] = *a0++;
+		/*
+			Calls visit(position, rank) for the n positions in order of rank, by an
+			in-order walk with an explicit stack. A frame is a node and the last
+			child visited, after child c comes key c of the node.
+		*/
+		template <typename Visit>
+		static void walk(int n, Visit&& visit) {
+			std::vector<std::pair<int, unsigned>> stack{};
+			auto descend = [&](int i) {
+				while (i < n) {
+					stack.emplace_back(i, 0);
+					i = child(0, i);
+				}
+			};
+			int rank = 0;
+			descend(0);
+			while (!stack.empty()) {
+				auto [i, c] = stack.back();
+				if (c < B && i + int(c) < n) {
+					visit(i + c, rank++);
 				}
+				if (c == B) {
+					stack.pop_back();
+					continue;
+				}
+				stack.back().second = c + 1;
+				descend(child(c + 1, i));
 			}
-			return a0;
 		}
 
 		int search(int x) {
@@ -85,7 +106,7 @@ namespace array {
 			int j = size;
 			int i = 0;
 			while (i + B <= size) {
-				int t = branchy_inner_search<B>(a.data(), i, x);
+				int t = branchy_inner_search<B>(a, i, x);
 				j = t < i + B ? t : j;
 				i = child((unsigned)(t - i), i);
 			}
@@ -115,18 +136,27 @@ namespace array {
 			int j = size;
 			int i = 0;
 			while (i + B <= size) {
-				__builtin_prefetch(a.data() + child(i, B / 2), 0, 0);
-				const kmers::RI_Kmer* base = &a[i];
-				const kmers::RI_Kmer* pred = branchfree_inner_search<B>(base, x);
-				unsigned int nth = (*pred < x) + pred - base;
-				{
-					/* nth == B iff x > all values in block. */
-					const kmers::RI_Kmer current = base[nth % B];
-					int next = i + nth;
-					j = (current >= x) ? next : j;
-				}
-				i = child(nth, i);
+				__builtin_prefetch(a + child(i, B / 2), 0, 0);
+				branchfree_step(x, i, j);
+			}
+			return last_block_search(x, i, j);
+		}
+
+		// One full block of unrolled_branchfree_search, moves i to the child to visit.
+		void branchfree_step(int x, int& i, int& j) const {
+			const kmers::RI_Kmer* base = &a[i];
+			const kmers::RI_Kmer* pred = branchfree_inner_search<B>(base, x);
+			unsigned int nth = (*pred < x) + pred - base;
+			{
+				/* nth == B iff x > all values in block. */
+				const kmers::RI_Kmer current = base[nth % B];
+				int next = i + nth;
+				j = (current >= x) ? next : j;
 			}
+			i = child(nth, i);
+		}
+
+		int last_block_search(int x, int i, int j) const {
 			if (__builtin_expect(i < size, 0)) {
 				// last (partial) block
 				const kmers::RI_Kmer* base = &a[i];
@@ -139,12 +169,38 @@ namespace array {
 					m -= half;
 				}
 
-				int ret = (*base < x) + base - a.data();
+				int ret = (*base < x) + base - a;
 				return (ret == size) ? j : ret;
 			}
 			return j;
 		}
 
+		/*
+			Same result as unrolled_branchfree_search for each of count <= batch_size
+			keys. The searches advance one block at a time in lockstep and prefetch
+			their next block, so the cache misses of independent searches overlap.
+		*/
+		void search_batch(const int* xs, int* results, int count) const {
+			int i[batch_size];
+			int j[batch_size];
+			std::fill_n(i, count, 0);
+			std::fill_n(j, count, size);
+			bool active = true;
+			while (active) {
+				active = false;
+				for (int k = 0; k < count; k++) {
+					if (i[k] + B <= size) {
+						branchfree_step(xs[k], i[k], j[k]);
+						__builtin_prefetch(a + i[k], 0, 0);
+						active = true;
+					}
+				}
+			}
+			for (int k = 0; k < count; k++) {
+				results[k] = last_block_search(xs[k], i[k], j[k]);
+			}
+		}
+
 		kmers::RI_Kmer& get_from_array(const int i_rep) {
 			return a[unrolled_branchfree_search(i_rep)];
 		}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <new>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "read_in_kmer.hpp"
+
+/*
+  Blocked Bloom filter over the context keys of a VLMC, consulted before the
+  search of the searched containers so that most missing contexts are
+  rejected with one cache line read instead of a full descent. Every key sets
+  nr_hashes bits within one 512 bit block chosen by its hash.
+*/
+namespace bloom {
+  // Set from '--filter-fpr' before loading, 0 builds no filters.
+  inline double false_positive_rate = 0.0;
+
+  constexpr int block_words = 8;
+  constexpr int block_bits = 64 * block_words;
+  // A block is one cache line.
+  constexpr size_t block_alignment = block_words * sizeof(uint64_t);
+  constexpr int max_hashes = 16;
+
+  inline uint64_t hash(int key) {
+    uint64_t h = uint64_t(uint32_t(key)) * 0x9E3779B97F4A7C15ull;
+    h ^= h >> 32;
+    h *= 0xD6E8FEB86659FD93ull;
+    return h ^ (h >> 32);
+  }
+
+  // Bits per key for the rate, with 20% more than an unblocked filter to make up for the uneven load of the blocks.
+  inline double bits_per_key(double rate) { return 1.2 * std::log2(1.0 / rate) / std::log(2.0); }
+
+  struct Blocked_Bloom {
+    uint32_t nr_blocks = 0;
+    int nr_hashes = 0;
+    // Not owned unless built without storage.
+    uint64_t* words = nullptr;
+    std::shared_ptr<uint64_t[]> owned{};
+
+    Blocked_Bloom() = default;
+    ~Blocked_Bloom() = default;
+
+    static uint32_t blocks(size_t nr_keys, double rate) {
+      return std::max<size_t>(1, std::ceil(nr_keys * bits_per_key(rate) / block_bits));
+    }
+
+    // storage holds block_words * blocks(keys.size(), rate) words aligned to a block, or is null to allocate them.
+    Blocked_Bloom(const std::vector<int>& keys, double rate, uint64_t* storage = nullptr)
+      : nr_blocks(blocks(keys.size(), rate)), words(storage) {
+      nr_hashes = std::clamp(int(std::lround(bits_per_key(rate) / 1.2 * std::log(2.0))), 1, max_hashes);
+      if (words == nullptr) {
+        owned = std::shared_ptr<uint64_t[]>(
+          static_cast<uint64_t*>(::operator new(bytes(), std::align_val_t(block_alignment))),
+          [](uint64_t* data) { ::operator delete(data, std::align_val_t(block_alignment)); });
+        words = owned.get();
+      }
+      std::fill(words, words + size_t(nr_blocks) * block_words, 0);
+      for (int key : keys) {
+        uint64_t h = hash(key);
+        uint64_t* block = words + block_of(h) * block_words;
+        for (int i = 0; i < nr_hashes; i++) {
+          h *= 0x9E3779B97F4A7C15ull;
+          block[h >> 61] |= uint64_t(1) << ((h >> 55) & 63);
+        }
+      }
+    }
+
+    size_t block_of(uint64_t h) const { return ((h >> 32) * nr_blocks) >> 32; }
+
+    size_t bytes() const { return size_t(nr_blocks) * block_words * sizeof(uint64_t); }
+
+    // False only if key is not in the VLMC, always true without a filter.
+    bool may_contain(int key) const {
+      if (nr_blocks == 0) {
+        return true;
+      }
+      uint64_t h = hash(key);
+      const uint64_t* block = words + block_of(h) * block_words;
+      bool found = true;
+      for (int i = 0; i < nr_hashes; i++) {
+        h *= 0x9E3779B97F4A7C15ull;
+        found &= (block[h >> 61] >> ((h >> 55) & 63)) & 1;
+      }
+      return found;
+    }
+  };
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <array>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "read_in_kmer.hpp"
+
+/*
+  Shared steps of the container constructors: sorting the kmers by key and
+  moving them into a layout. Both work on 8 byte (key, index) pairs or 4 byte
+  ranks and move every kmer once, and both split large VLMCs over threads.
+*/
+namespace construction {
+  using RI_Kmer = kmers::RI_Kmer;
+
+  constexpr int digit_bits = 11;
+  constexpr size_t nr_digits = size_t(1) << digit_bits;
+  // Below this many kmers std::sort on the kmers is faster than the radix passes.
+  constexpr size_t min_radix_size = 256;
+  // Below this many kmers a VLMC is built by one thread.
+  constexpr size_t min_parallel_size = size_t(1) << 16;
+
+  // Runs fun(t, start, stop) for nr_threads contiguous ranges of [0, n), on the calling thread if there is one range.
+  template <typename Fun>
+  void for_ranges(size_t n, size_t nr_threads, Fun&& fun) {
+    nr_threads = std::max<size_t>(1, std::min(nr_threads, n / min_parallel_size));
+    if (nr_threads == 1) {
+      fun(size_t(0), size_t(0), n);
+      return;
+    }
+    // Threads inherit the affinity of the caller, so in the NUMA mode they stay on its node.
+    std::vector<std::thread> threads{};
+    for (size_t t = 0; t < nr_threads; t++) {
+      threads.emplace_back([&fun, t, n, nr_threads]() { fun(t, n * t / nr_threads, n * (t + 1) / nr_threads); });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  inline size_t digit(uint64_t pair, int pass) { return (pair >> (32 + pass * digit_bits)) & (nr_digits - 1); }
+
+  /*
+    LSD radix sort of the (key << 32 | index) pairs by key, with 11 bit digits
+    and only as many passes as the largest key needs. Every thread counts the
+    digits of its range, and the counts give it its own slice of every bucket.
+  */
+  void sort_pairs(std::vector<uint64_t>& pairs, int key_bits, size_t nr_threads) {
+    std::vector<uint64_t> buffer(pairs.size());
+    int nr_passes = (key_bits + digit_bits - 1) / digit_bits;
+    size_t nr_ranges = std::max<size_t>(1, std::min(nr_threads, pairs.size() / min_parallel_size));
+    std::vector<std::vector<size_t>> offsets(nr_ranges, std::vector<size_t>(nr_digits));
+    for (int pass = 0; pass < nr_passes; pass++) {
+      for_ranges(pairs.size(), nr_ranges, [&](size_t t, size_t start, size_t stop) {
+        std::fill(offsets[t].begin(), offsets[t].end(), 0);
+        for (size_t i = start; i < stop; i++) {
+          offsets[t][digit(pairs[i], pass)]++;
+        }
+      });
+      size_t sum = 0;
+      for (size_t d = 0; d < nr_digits; d++) {
+        for (size_t t = 0; t < nr_ranges; t++) {
+          size_t count = offsets[t][d];
+          offsets[t][d] = sum;
+          sum += count;
+        }
+      }
+      for_ranges(pairs.size(), nr_ranges, [&](size_t t, size_t start, size_t stop) {
+        auto& offset = offsets[t];
+        for (size_t i = start; i < stop; i++) {
+          buffer[offset[digit(pairs[i], pass)]++] = pairs[i];
+        }
+      });
+      pairs.swap(buffer);
+    }
+  }
+
+  // to[i] = from[order[i]] for i in [0, n).
+  template <typename Index>
+  void gather(const RI_Kmer* from, const Index* order, size_t n, RI_Kmer* to, size_t nr_threads) {
+    for_ranges(n, nr_threads, [&](size_t t, size_t start, size_t stop) {
+      for (size_t i = start; i < stop; i++) {
+        to[i] = from[order[i]];
+      }
+    });
+  }
+
+  /*
+    Moves the n sorted kmers into the positions [first, first + n) of a
+    layout, walk(visit) calls visit(position, rank) for every position. One
+    thread moves the kmers during the walk, more threads record the ranks and
+    move the kmers in position order.
+  */
+  template <typename Walk>
+  void layout(const RI_Kmer* sorted, size_t n, RI_Kmer* storage, size_t first, size_t nr_threads, Walk&& walk) {
+    if (nr_threads <= 1 || n < 2 * min_parallel_size) {
+      walk([&](int position, int rank) { storage[position] = sorted[rank]; });
+      return;
+    }
+    std::vector<int> ranks(n);
+    walk([&](int position, int rank) { ranks[position - first] = rank; });
+    gather(sorted, ranks.data(), n, storage + first, nr_threads);
+  }
+
+  // Sorts kmers by integer_rep, as std::sort but moving every kmer once.
+  void sort_kmers(std::vector<RI_Kmer>& kmers, size_t nr_threads = 1) {
+    if (kmers.size() < min_radix_size) {
+      std::sort(kmers.begin(), kmers.end());
+      return;
+    }
+    int max_key = 0;
+    for (auto& kmer : kmers) {
+      if (kmer.integer_rep < 0) {
+        std::sort(kmers.begin(), kmers.end());
+        return;
+      }
+      max_key = std::max(max_key, kmer.integer_rep);
+    }
+    std::vector<uint64_t> pairs(kmers.size());
+    for (size_t i = 0; i < kmers.size(); i++) {
+      pairs[i] = uint64_t(kmers[i].integer_rep) << 32 | i;
+    }
+    int key_bits = max_key == 0 ? 1 : 32 - __builtin_clz(max_key);
+    sort_pairs(pairs, key_bits, nr_threads);
+
+    std::vector<uint32_t> order(pairs.size());
+    for (size_t i = 0; i < pairs.size(); i++) {
+      order[i] = uint32_t(pairs[i]);
+    }
+    std::vector<RI_Kmer> sorted(kmers.size());
+    gather(kmers.data(), order.data(), kmers.size(), sorted.data(), nr_threads);
+    kmers.swap(sorted);
+  }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <vector>
+#include <cassert>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "read_in_kmer.hpp"
+#include "unordered_dense.h"
+
+namespace array {
+  /*
+    The context tree of a VLMC as an array of its nodes in depth first order.
+    A context of length l is the key k and its parent the key (k - 1) / 4, so
+    the contexts missing on the path to the root are added as nodes without a
+    kmer. Every node holds the position after its subtree, so a subtree can be
+    skipped in one step, and its position in the depth first order of all
+    contexts, so two tries are walked at once by comparing these.
+  */
+  struct Context_Trie {
+    struct Node {
+      // The digits of the context left aligned to max_level, then its length.
+      uint64_t order;
+      // Position of the next node outside the subtree.
+      int next;
+      // Index of the kmer, -1 for a context only on the path to others.
+      int kmer;
+    };
+
+    // The longest contexts whose keys all fit in an int, some keys of length 16 do not.
+    static constexpr int max_level = 15;
+    int size = 0;
+    int nr_nodes = 0;
+    // Not owned, nr_nodes nodes and size kmers, both in depth first order.
+    Node* nodes = nullptr;
+    kmers::RI_Kmer* kmers = nullptr;
+
+    Context_Trie() = default;
+    ~Context_Trie() = default;
+
+    // nodes holds the nodes from build_nodes, kmer_storage size kmers.
+    Context_Trie(const std::vector<kmers::RI_Kmer>& from_container, const std::vector<Node>& from_nodes,
+      Node* node_storage, kmers::RI_Kmer* kmer_storage)
+      : size(from_container.size()), nr_nodes(from_nodes.size()), nodes(node_storage), kmers(kmer_storage) {
+      int rank = 0;
+      for (int i = 0; i < nr_nodes; i++) {
+        nodes[i] = from_nodes[i];
+        if (nodes[i].kmer >= 0) {
+          kmers[rank] = from_container[nodes[i].kmer];
+          nodes[i].kmer = rank++;
+        }
+      }
+    }
+
+    static int level(int key) { return (63 - __builtin_clzll(3 * uint64_t(key) + 1)) / 2; }
+
+    static int parent(int key) { return (key - 1) / 4; }
+
+    static uint64_t dfs_order(int key) {
+      assert(key >= 0);
+      int l = level(key);
+      assert(l <= max_level);
+      uint64_t digits = uint64_t(key) - ((uint64_t(1) << 2 * l) - 1) / 3;
+      return (digits << 2 * (max_level - l)) << 5 | l;
+    }
+
+    /*
+      The nodes of the contexts and their ancestors in depth first order, with
+      kmer the index into from_container. The end of every subtree is found
+      with a stack of the open nodes. Keys longer than max_level, or that
+      overflowed, are rejected even without asserts.
+    */
+    static std::vector<Node> build_nodes(const std::vector<kmers::RI_Kmer>& from_container) {
+      ankerl::unordered_dense::set<int> present{};
+      std::vector<Node> nodes{};
+      nodes.reserve(from_container.size() + 1);
+      for (int i = 0; i < int(from_container.size()); i++) {
+        int key = from_container[i].integer_rep;
+        if (key < 0 || level(key) > max_level) {
+          throw std::runtime_error("Context key " + std::to_string(key) + " is longer than the context trie supports.");
+        }
+        present.insert(key);
+        nodes.push_back({ dfs_order(from_container[i].integer_rep), 0, i });
+      }
+      for (auto& kmer : from_container) {
+        for (int key = kmer.integer_rep; key > 0 && present.insert(parent(key)).second; key = parent(key)) {
+          nodes.push_back({ dfs_order(parent(key)), 0, -1 });
+        }
+      }
+      std::sort(nodes.begin(), nodes.end(), [](const Node& a, const Node& b) { return a.order < b.order; });
+
+      std::vector<int> open{};
+      for (int i = 0; i < int(nodes.size()); i++) {
+        int l = nodes[i].order & 31;
+        while (!open.empty() && int(nodes[open.back()].order & 31) >= l) {
+          nodes[open.back()].next = i;
+          open.pop_back();
+        }
+        open.push_back(i);
+      }
+      for (int i : open) {
+        nodes[i].next = nodes.size();
+      }
+      return nodes;
+    }
+
+    // Index of the kmer of key, or -1 if it is not present. Descends from the root, skipping siblings.
+    int find(int key) const {
+      uint64_t target = dfs_order(key);
+      int i = 0;
+      int end = nr_nodes;
+      while (i < end) {
+        if (nodes[i].order == target) {
+          return nodes[i].kmer;
+        }
+        if (nodes[i].order > target) {
+          return -1;
+        }
+        int sibling = nodes[i].next;
+        if (sibling < end && nodes[sibling].order <= target) {
+          i = sibling;
+        }
+        else {
+          end = sibling;
+          i++;
+        }
+      }
+      return -1;
+    }
+  };
+
+  /*
+    Calls f(left_index, right_index) for every context in both tries. The
+    walk advances the node that comes first in depth first order, and as the
+    tries hold all ancestors of their contexts, a node missing from the other
+    trie has its whole subtree missing and is skipped. Returns the number of
+    nodes visited.
+  */
+  template <typename F>
+  long intersect_tries(const Context_Trie& left, const Context_Trie& right, F&& f) {
+    int i = 0;
+    int j = 0;
+    long visited = 0;
+    while (i < left.nr_nodes && j < right.nr_nodes) {
+      visited++;
+      uint64_t left_order = left.nodes[i].order;
+      uint64_t right_order = right.nodes[j].order;
+      if (left_order == right_order) {
+        if (left.nodes[i].kmer >= 0 && right.nodes[j].kmer >= 0) {
+          f(left.nodes[i].kmer, right.nodes[j].kmer);
+        }
+        i++;
+        j++;
+      }
+      else if (left_order < right_order) {
+        i = left.nodes[i].next;
+      }
+      else {
+        j = right.nodes[j].next;
+      }
+    }
+    return visited;
+  }
+}
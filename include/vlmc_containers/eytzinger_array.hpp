@@ -3,6 +3,7 @@
 #include <iostream>
 
 #include "read_in_kmer.hpp"
+#include "construction.hpp"
 #include <bits/stdc++.h>
 
 namespace array {
@@ -10,38 +11,82 @@ namespace array {
     kmers::RI_Kmer null_kmer = kmers::RI_Kmer(-1);
     int size;
     static const int block_size = 2; // = 64 / sizeof(RI_Kmer)
+    static constexpr int batch_size = 16;
     kmers::RI_Kmer* kmer_from;
-    alignas(64) std::vector<kmers::RI_Kmer> ey_sorted_kmers;
+    // Not owned, storage_size(size) kmers.
+    kmers::RI_Kmer* ey_sorted_kmers;
 
     Ey_array() = default;
-    Ey_array(std::vector<kmers::RI_Kmer>& from_container) {
+    Ey_array(std::vector<kmers::RI_Kmer>& from_container, kmers::RI_Kmer* storage, size_t nr_threads = 1) {
       size = from_container.size();
       kmer_from = from_container.data();
-      ey_sorted_kmers.reserve(size + 1);
+      ey_sorted_kmers = storage;
       ey_sorted_kmers[0] = null_kmer;
-      construct();
+      construction::layout(from_container.data(), size, ey_sorted_kmers, 1, nr_threads, [&](auto&& visit) { walk(size, visit); });
     }
     ~Ey_array() = default;
 
-    int construct(int i = 0, int k = 1) {
-      if (k <= size) {
-        i = Ey_array::construct(i, 2 * k);
-        ey_sorted_kmers[k] = kmer_from[i++];
-        i = Ey_array::construct(i, 2 * k + 1);
+    static size_t storage_size(size_t n) { return n + 1; }
+
+    /*
+      Calls visit(position, rank) for the positions 1..n in order of rank,
+      without recursion: the successor of k is the leftmost node of its right
+      subtree, or else the parent of the first left child above it.
+    */
+    template <typename Visit>
+    static void walk(int n, Visit&& visit) {
+      int k = 1;
+      while (2 * k <= n) {
+        k *= 2;
+      }
+      for (int i = 0; i < n; i++) {
+        visit(k, i);
+        if (2 * k + 1 <= n) {
+          k = 2 * k + 1;
+          while (2 * k <= n) {
+            k *= 2;
+          }
+        }
+        else {
+          k >>= __builtin_ffs(~k);
+        }
       }
-      return i;
     }
 
     int search(int x) {
       int k = 1;
       while (k <= size) {
-        __builtin_prefetch(ey_sorted_kmers.data() + k * block_size);
+        __builtin_prefetch(ey_sorted_kmers + k * block_size);
         k = 2 * k + (ey_sorted_kmers[k] < x);
       }
       k >>= __builtin_ffs(~k);
       return k;
     }
 
+    /*
+      Same result as search for each of count <= batch_size keys. The searches
+      advance one level at a time in lockstep and prefetch their next node, so
+      the cache misses of independent searches overlap.
+    */
+    void search_batch(const int* xs, int* results, int count) const {
+      int k[batch_size];
+      std::fill_n(k, count, 1);
+      bool active = true;
+      while (active) {
+        active = false;
+        for (int j = 0; j < count; j++) {
+          if (k[j] <= size) {
+            k[j] = 2 * k[j] + (ey_sorted_kmers[k[j]].integer_rep < xs[j]);
+            __builtin_prefetch(ey_sorted_kmers + k[j]);
+            active = true;
+          }
+        }
+      }
+      for (int j = 0; j < count; j++) {
+        results[j] = k[j] >> __builtin_ffs(~k[j]);
+      }
+    }
+
     kmers::RI_Kmer& get_from_array(const int i_rep) {
       return ey_sorted_kmers[search(i_rep)];
     }
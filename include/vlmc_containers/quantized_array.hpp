@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "read_in_kmer.hpp"
+
+namespace array {
+  /*
+    Sorted keys with the next char probabilities stored apart as fixed point T,
+    probability = q * scale. The scale is per VLMC and maps the largest
+    magnitude to the largest T, so the intersection only streams the keys and
+    a matched context reads 4 * sizeof(T) bytes instead of 32.
+  */
+  template <typename T>
+  struct Quantized_Array {
+    static constexpr int max_q = std::numeric_limits<T>::max();
+    int size = 0;
+    double scale = 1.0;
+    // Not owned, size keys and 4 * size probabilities.
+    int* keys = nullptr;
+    T* probs = nullptr;
+
+    Quantized_Array() = default;
+    ~Quantized_Array() = default;
+
+    Quantized_Array(const std::vector<kmers::RI_Kmer>& from_container, int* key_storage, T* prob_storage)
+      : size(from_container.size()), keys(key_storage), probs(prob_storage) {
+      double max_abs = 0.0;
+      for (auto& kmer : from_container) {
+        for (int x = 0; x < 4; x++) {
+          max_abs = std::max(max_abs, std::abs(double(kmer.next_char_prob[x])));
+        }
+      }
+      if (max_abs > 0.0) {
+        scale = max_abs / max_q;
+      }
+      for (int i = 0; i < size; i++) {
+        keys[i] = from_container[i].integer_rep;
+        for (int x = 0; x < 4; x++) {
+          probs[4 * i + x] = T(std::lround(from_container[i].next_char_prob[x] / scale));
+        }
+      }
+    }
+
+    // The dequantized kmer at index i.
+    kmers::RI_Kmer kmer(int i) const {
+      kmers::RI_Kmer kmer{ keys[i] };
+      for (int x = 0; x < 4; x++) {
+        kmer.next_char_prob[x] = probs[4 * i + x] * scale;
+      }
+      return kmer;
+    }
+  };
+
+  // Integer dot product and norms over matched contexts, in units of the two scales.
+  struct Int_dot_norm {
+    int64_t dot_product = 0;
+    int64_t left_norm = 0;
+    int64_t right_norm = 0;
+  };
+
+#if defined(__AVX2__)
+  // Probabilities of 4 kmers as 16 int16 lanes, one kmer per 64 bits.
+  inline __m256i load_4_kmers(const int16_t* probs, const int* idx) {
+    int64_t v[4];
+    for (int k = 0; k < 4; k++) {
+      std::memcpy(&v[k], probs + 4 * idx[k], sizeof(int64_t));
+    }
+    return _mm256_set_epi64x(v[3], v[2], v[1], v[0]);
+  }
+
+  inline __m256i load_4_kmers(const int8_t* probs, const int* idx) {
+    int32_t v[4];
+    for (int k = 0; k < 4; k++) {
+      std::memcpy(&v[k], probs + 4 * idx[k], sizeof(int32_t));
+    }
+    return _mm256_cvtepi8_epi16(_mm_set_epi32(v[3], v[2], v[1], v[0]));
+  }
+
+  // Adds the 8 int32 lanes of v to the 4 int64 lanes of acc.
+  inline __m256i add_widened(__m256i acc, __m256i v) {
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+    return _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+  }
+
+  inline int64_t horizontal_sum(__m256i v) {
+    int64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+#endif
+
+  /*
+    Accumulates the matched pairs (left_idx[k], right_idx[k]) into acc. The
+    AVX2 path multiplies 4 pairs per vpmaddwd, whose int32 lanes hold two
+    products each and cannot overflow for int16, and widens into int64.
+  */
+  template <typename T>
+  void dot_norm(const Quantized_Array<T>& left, const Quantized_Array<T>& right,
+    const int* left_idx, const int* right_idx, int count, Int_dot_norm& acc) {
+    int k = 0;
+#if defined(__AVX2__)
+    __m256i dot_product = _mm256_setzero_si256();
+    __m256i left_norm = _mm256_setzero_si256();
+    __m256i right_norm = _mm256_setzero_si256();
+    for (; k + 4 <= count; k += 4) {
+      __m256i l = load_4_kmers(left.probs, left_idx + k);
+      __m256i r = load_4_kmers(right.probs, right_idx + k);
+      dot_product = add_widened(dot_product, _mm256_madd_epi16(l, r));
+      left_norm = add_widened(left_norm, _mm256_madd_epi16(l, l));
+      right_norm = add_widened(right_norm, _mm256_madd_epi16(r, r));
+    }
+    acc.dot_product += horizontal_sum(dot_product);
+    acc.left_norm += horizontal_sum(left_norm);
+    acc.right_norm += horizontal_sum(right_norm);
+#endif
+    for (; k < count; k++) {
+      const T* l = left.probs + 4 * left_idx[k];
+      const T* r = right.probs + 4 * right_idx[k];
+      for (int x = 0; x < 4; x++) {
+        acc.dot_product += int64_t(l[x]) * r[x];
+        acc.left_norm += int64_t(l[x]) * l[x];
+        acc.right_norm += int64_t(r[x]) * r[x];
+      }
+    }
+  }
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "read_in_kmer.hpp"
+
+namespace array {
+  /*
+    Presence bitvector over the context keys with a rank directory, next to
+    the kmers in key order. Bit i is the key base + i and the kmer of a present
+    key is at its rank, the number of set bits before it. The bits are cut into
+    blocks of 512 and ranks[b] counts the set bits before block b. base is a
+    multiple of the block size, so the blocks of two VLMCs line up and their
+    intersection is a word wise AND.
+
+    Sparse key ranges, where the bits would take more space than the keys,
+    store the sorted keys instead and are searched.
+  */
+  struct Rank_Bitvector {
+    static constexpr int words_per_block = 8;
+    static constexpr int block_bits = 64 * words_per_block;
+    // Dense when there are at most this many keys in the range per context, the bits then take at most the space of int keys.
+    static constexpr long max_range_per_key = 32;
+    int size = 0;
+    bool dense = false;
+    int base = 0;
+    int nr_blocks = 0;
+    // Not owned, 8 * nr_blocks words and nr_blocks ranks when dense, size keys otherwise, and size kmers.
+    uint64_t* bits = nullptr;
+    uint32_t* ranks = nullptr;
+    int* keys = nullptr;
+    kmers::RI_Kmer* kmers = nullptr;
+
+    Rank_Bitvector() = default;
+    ~Rank_Bitvector() = default;
+
+    // from_container is sorted, the storage is given as sized by storage_blocks.
+    Rank_Bitvector(const std::vector<kmers::RI_Kmer>& from_container, uint64_t* bit_storage, uint32_t* rank_storage,
+      int* key_storage, kmers::RI_Kmer* kmer_storage)
+      : size(from_container.size()), bits(bit_storage), ranks(rank_storage), keys(key_storage), kmers(kmer_storage) {
+      std::copy(from_container.begin(), from_container.end(), kmers);
+      nr_blocks = storage_blocks(from_container);
+      dense = nr_blocks > 0;
+      if (!dense) {
+        for (int i = 0; i < size; i++) {
+          keys[i] = kmers[i].integer_rep;
+        }
+        return;
+      }
+      base = block_base(kmers[0].integer_rep);
+      std::fill(bits, bits + size_t(nr_blocks) * words_per_block, 0);
+      for (int i = 0; i < size; i++) {
+        int offset = kmers[i].integer_rep - base;
+        bits[offset >> 6] |= uint64_t(1) << (offset & 63);
+      }
+      uint32_t rank = 0;
+      for (int b = 0; b < nr_blocks; b++) {
+        ranks[b] = rank;
+        for (int w = 0; w < words_per_block; w++) {
+          rank += __builtin_popcountll(bits[b * words_per_block + w]);
+        }
+      }
+    }
+
+    static int block_base(int key) { return key / block_bits * block_bits; }
+
+    // Blocks of the bitvector for the sorted kmers, 0 if they are stored sparse.
+    static int storage_blocks(const std::vector<kmers::RI_Kmer>& sorted) {
+      if (sorted.empty()) {
+        return 0;
+      }
+      long base = block_base(sorted.front().integer_rep);
+      long range = long(sorted.back().integer_rep) - base + 1;
+      if (range > max_range_per_key * long(sorted.size())) {
+        return 0;
+      }
+      return (range + block_bits - 1) / block_bits;
+    }
+
+    int end_key() const { return base + nr_blocks * block_bits; }
+
+    // Index of the kmer of key, or -1 if it is not present.
+    int find(int key) const {
+      if (!dense) {
+        const int* it = std::lower_bound(keys, keys + size, key);
+        return (it != keys + size && *it == key) ? int(it - keys) : -1;
+      }
+      if (key < base || key >= end_key()) {
+        return -1;
+      }
+      int offset = key - base;
+      int word = offset >> 6;
+      uint64_t below = (uint64_t(1) << (offset & 63)) - 1;
+      if (((bits[word] >> (offset & 63)) & 1) == 0) {
+        return -1;
+      }
+      int rank = ranks[word / words_per_block];
+      for (int w = word & ~(words_per_block - 1); w < word; w++) {
+        rank += __builtin_popcountll(bits[w]);
+      }
+      return rank + __builtin_popcountll(bits[word] & below);
+    }
+  };
+
+  // True if the blocks at left and right share a key, two 256 bit ANDs with AVX2.
+  inline bool blocks_intersect(const uint64_t* left, const uint64_t* right) {
+#if defined(__AVX2__)
+    __m256i low = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(left)),
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(right)));
+    __m256i high = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(left + 4)),
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(right + 4)));
+    return !_mm256_testz_si256(_mm256_or_si256(low, high), _mm256_set1_epi64x(-1));
+#else
+    uint64_t any = 0;
+    for (int w = 0; w < Rank_Bitvector::words_per_block; w++) {
+      any |= left[w] & right[w];
+    }
+    return any != 0;
+#endif
+  }
+
+  /*
+    Calls f(left_index, right_index) for every key in both dense bitvectors, in
+    key order. Blocks without a common key are skipped after the AND, the
+    others are walked word by word with the ranks from the directory and
+    popcounts. Returns the number of blocks compared.
+  */
+  template <typename F>
+  long intersect_dense(const Rank_Bitvector& left, const Rank_Bitvector& right, F&& f) {
+    constexpr int words = Rank_Bitvector::words_per_block;
+    constexpr int block_bits = Rank_Bitvector::block_bits;
+    int start = std::max(left.base, right.base);
+    int stop = std::min(left.end_key(), right.end_key());
+    long nr_blocks = 0;
+    for (int key = start; key < stop; key += block_bits) {
+      nr_blocks++;
+      int left_block = (key - left.base) / block_bits;
+      int right_block = (key - right.base) / block_bits;
+      const uint64_t* left_words = left.bits + size_t(left_block) * words;
+      const uint64_t* right_words = right.bits + size_t(right_block) * words;
+      if (!blocks_intersect(left_words, right_words)) {
+        continue;
+      }
+      int left_rank = left.ranks[left_block];
+      int right_rank = right.ranks[right_block];
+      for (int w = 0; w < words; w++) {
+        uint64_t both = left_words[w] & right_words[w];
+        while (both != 0) {
+          uint64_t below = (both & -both) - 1;
+          f(left_rank + __builtin_popcountll(left_words[w] & below), right_rank + __builtin_popcountll(right_words[w] & below));
+          both &= both - 1;
+        }
+        left_rank += __builtin_popcountll(left_words[w]);
+        right_rank += __builtin_popcountll(right_words[w]);
+      }
+    }
+    return nr_blocks;
+  }
+}
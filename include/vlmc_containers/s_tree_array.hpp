@@ -0,0 +1,158 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <limits.h>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "read_in_kmer.hpp"
+
+namespace array {
+  /*
+    Static B+ tree where every node is one cache line of 16 int keys. An inner
+    node holds the largest key of each of its 16 children, the leaves hold the
+    sorted keys and position i of the leaves indexes kmers[i]. Levels are stored
+    root first in one array and padded with INT_MAX, which must be 64 byte
+    aligned.
+  */
+  struct S_Tree {
+    static constexpr int B = 16;
+    static constexpr int batch_size = 16;
+    // 16^8 leaves is more than an int can index.
+    static constexpr int max_levels = 8;
+    kmers::RI_Kmer null_kmer = kmers::RI_Kmer(-1);
+    int size;
+    int nr_levels;
+    // Start of each level in keys, level 0 is the root.
+    std::array<int, max_levels + 1> level_offset{};
+    // Not owned, storage_size(size) keys and size kmers.
+    int* keys;
+    kmers::RI_Kmer* kmers;
+
+    S_Tree() = default;
+    ~S_Tree() = default;
+
+    S_Tree(std::vector<kmers::RI_Kmer>& from_container, int* key_storage, kmers::RI_Kmer* kmer_storage)
+      : size(from_container.size()), keys(key_storage), kmers(kmer_storage) {
+      std::copy(from_container.begin(), from_container.end(), kmers);
+      nr_levels = levels(size, level_offset);
+      std::fill(keys, keys + level_offset[nr_levels], INT_MAX);
+
+      int leaves = level_offset[nr_levels - 1];
+      for (int i = 0; i < size; i++) {
+        keys[leaves + i] = kmers[i].integer_rep;
+      }
+      for (int level = nr_levels - 2; level >= 0; level--) {
+        int child_offset = level_offset[level + 1];
+        int nr_children = (level_offset[level + 2] - child_offset) / B;
+        for (int child = 0; child < nr_children; child++) {
+          keys[level_offset[level] + child] = keys[child_offset + child * B + B - 1];
+        }
+      }
+    }
+
+    static int round_up(int n) { return (n + B - 1) / B * B; }
+
+    // Fills in the level offsets for n keys, offsets[levels] is the total number of keys.
+    static int levels(int n, std::array<int, max_levels + 1>& offsets) {
+      // Number of keys per level from the leaves up.
+      std::array<int, max_levels> level_sizes{};
+      int nr_levels = 1;
+      level_sizes[0] = round_up(std::max(n, 1));
+      while (level_sizes[nr_levels - 1] > B) {
+        level_sizes[nr_levels] = round_up(level_sizes[nr_levels - 1] / B);
+        nr_levels++;
+      }
+      offsets[0] = 0;
+      for (int level = 0; level < nr_levels; level++) {
+        offsets[level + 1] = offsets[level] + level_sizes[nr_levels - 1 - level];
+      }
+      return nr_levels;
+    }
+
+    static size_t storage_size(size_t n) {
+      std::array<int, max_levels + 1> offsets{};
+      return offsets[levels(n, offsets)];
+    }
+
+    // Number of keys in the node that are smaller than x.
+    static int rank(const int* node, int x) {
+#if defined(__AVX512F__)
+      __m512i x_vec = _mm512_set1_epi32(x);
+      __mmask16 mask = _mm512_cmplt_epi32_mask(_mm512_load_si512(node), x_vec);
+      return __builtin_popcount(mask);
+#elif defined(__AVX2__)
+      __m256i x_vec = _mm256_set1_epi32(x);
+      __m256i lo = _mm256_cmpgt_epi32(x_vec, _mm256_load_si256(reinterpret_cast<const __m256i*>(node)));
+      __m256i hi = _mm256_cmpgt_epi32(x_vec, _mm256_load_si256(reinterpret_cast<const __m256i*>(node + 8)));
+      unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(lo)) | (_mm256_movemask_ps(_mm256_castsi256_ps(hi)) << 8);
+      return __builtin_popcount(mask);
+#else
+      int r = 0;
+      for (int i = 0; i < B; i++) {
+        r += node[i] < x;
+      }
+      return r;
+#endif
+    }
+
+    // Number of nodes of a level.
+    int nr_nodes(int level) const { return (level_offset[level + 1] - level_offset[level]) / B; }
+
+    /*
+      Child of node for a rank r of x in it, or -1 if x is larger than every
+      key. An x above the real keys ranks among the INT_MAX padding, whose
+      children lie past the end of the next level.
+    */
+    int child(int level, int node, int r) const {
+      if (r == B || (level + 1 < nr_levels && node * B + r >= nr_nodes(level + 1))) {
+        return -1;
+      }
+      return node * B + r;
+    }
+
+    // Index of the first kmer with integer_rep >= x, size if there is none.
+    int search(int x) const {
+      int node = 0;
+      for (int level = 0; level < nr_levels; level++) {
+        node = child(level, node, rank(keys + level_offset[level] + node * B, x));
+        if (node < 0) {
+          return size;
+        }
+      }
+      return std::min(node, size);
+    }
+
+    // Same result as search for each of count <= batch_size keys, with the levels of the searches interleaved.
+    void search_batch(const int* xs, int* results, int count) const {
+      for (int k = 0; k < count; k++) {
+        results[k] = 0;
+      }
+      for (int level = 0; level < nr_levels; level++) {
+        const int* base = keys + level_offset[level];
+        for (int k = 0; k < count; k++) {
+          if (results[k] == INT_MAX) {
+            continue;
+          }
+          int node = child(level, results[k], rank(base + results[k] * B, xs[k]));
+          results[k] = node < 0 ? INT_MAX : node;
+          if (results[k] != INT_MAX && level + 1 < nr_levels) {
+            __builtin_prefetch(keys + level_offset[level + 1] + results[k] * B);
+          }
+        }
+      }
+      for (int k = 0; k < count; k++) {
+        results[k] = std::min(results[k], size);
+      }
+    }
+
+    kmers::RI_Kmer& get_from_array(const int i_rep) {
+      int i = search(i_rep);
+      return i < size ? kmers[i] : null_kmer;
+    }
+  };
+}
@@ -6,11 +6,14 @@
 #include <iostream>
 
 #include "read_in_kmer.hpp"
+#include "construction.hpp"
 
 namespace array {
 	struct Veb_array {
-		alignas(64) std::vector<kmers::RI_Kmer> a;
+		// Not owned, storage_size(n) kmers.
+		kmers::RI_Kmer* a;
 		static const unsigned MAX_H = 32;
+		static constexpr int batch_size = 16;
 		int height;
 		int n;
 		typedef unsigned char h_type;
@@ -39,27 +42,41 @@ namespace array {
 			sequencer(h1, s, d + h0 + 1);
 		}
 
-		kmers::RI_Kmer* construct(kmers::RI_Kmer* a0, int* rtl, int path, unsigned d) {
-			if (d > height || rtl[d] >= n)
-				return a0;
-
-			// visit left child
-			path <<= 1;
-			rtl[d + 1] = rtl[d - s[d].h0] + s[d].m0 + (path & s[d].m0) * (s[d].m1);
-			a0 = construct(a0, rtl, path, d + 1);
-
-			a[rtl[d]] = *a0++;
-
-			// visit right child
-			path += 1;
-			rtl[d + 1] = rtl[d - s[d].h0] + s[d].m0 + (path & s[d].m0) * (s[d].m1);
-			a0 = construct(a0, rtl, path, d + 1);
-
-			return a0;
+		/*
+			Calls visit(position, rank) for the n positions in order of rank, by an
+			in-order walk with an explicit stack of the (path, depth) of the nodes
+			whose left subtree is being visited. rtl[d] is the position of the node
+			at depth d on the current path.
+		*/
+		template <typename Visit>
+		void walk(Visit&& visit) const {
+			std::vector<std::pair<int, unsigned>> stack{};
+			int rtl[MAX_H + 2];
+			rtl[0] = 0;
+			auto next = [&](int path, unsigned d) { return rtl[d - s[d].h0] + s[d].m0 + (path & s[d].m0) * (s[d].m1); };
+			auto descend = [&](int path, unsigned d) {
+				while (d <= unsigned(height) && rtl[d] < n) {
+					stack.emplace_back(path, d);
+					path <<= 1;
+					rtl[d + 1] = next(path, d);
+					d++;
+				}
+			};
+			int rank = 0;
+			descend(0, 0);
+			while (!stack.empty()) {
+				auto [path, d] = stack.back();
+				stack.pop_back();
+				visit(rtl[d], rank++);
+				path = (path << 1) + 1;
+				rtl[d + 1] = next(path, d);
+				descend(path, d + 1);
+			}
 		}
 
-		Veb_array(std::vector<kmers::RI_Kmer>& from_container) {
+		Veb_array(std::vector<kmers::RI_Kmer>& from_container, kmers::RI_Kmer* storage, size_t nr_threads = 1) {
 			n = from_container.size();
+			a = storage;
 			// find smallest h such that sum_i=0^h 2^h >= n
 			int m = 1;
 			for (height = 0; m < n; height++, m += 1 << height)
@@ -69,12 +86,11 @@ namespace array {
 			std::fill_n(s, MAX_H + 1, q);
 			sequencer(height, s, 0);
 
-			a.resize(n);
-			int rtl[MAX_H + 1];
-			rtl[0] = 0;
-			construct(from_container.data(), rtl, 0, 0);
+			construction::layout(from_container.data(), n, a, 0, nr_threads, [&](auto&& visit) { walk(visit); });
 		}
 
+		static size_t storage_size(size_t n) { return n; }
+
 		int search(int x) {
 			int rtl[MAX_H + 1];
 			int j = n;
@@ -97,6 +113,52 @@ namespace array {
 			return j;
 		}
 
+		/*
+			Same result as search for each of count <= batch_size keys. The searches
+			advance one level at a time in lockstep and prefetch their next node, so
+			the cache misses of independent searches overlap.
+		*/
+		void search_batch(const int* xs, int* results, int count) const {
+			int rtl[batch_size][MAX_H + 1];
+			int i[batch_size];
+			int p[batch_size];
+			bool done[batch_size];
+			for (int k = 0; k < count; k++) {
+				i[k] = 0;
+				p[k] = 0;
+				results[k] = n;
+				done[k] = n == 0;
+			}
+			bool active = true;
+			for (int d = 0; active; d++) {
+				active = false;
+				for (int k = 0; k < count; k++) {
+					if (done[k]) {
+						continue;
+					}
+					rtl[k][d] = i[k];
+					if (xs[k] < a[i[k]].integer_rep) {
+						p[k] <<= 1;
+						results[k] = i[k];
+					}
+					else if (xs[k] > a[i[k]].integer_rep) {
+						p[k] = (p[k] << 1) + 1;
+					}
+					else {
+						results[k] = i[k];
+						done[k] = true;
+						continue;
+					}
+					i[k] = rtl[k][d - s[d].h0] + s[d].m0 + (p[k] & s[d].m0) * (s[d].m1);
+					done[k] = i[k] >= n;
+					if (!done[k]) {
+						__builtin_prefetch(a + i[k], 0, 0);
+						active = true;
+					}
+				}
+			}
+		}
+
 		kmers::RI_Kmer& get_from_array(const int i_rep) {
 			return a[search(i_rep)];
 		}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <random>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <cereal/archives/binary.hpp>
+
+#include "kmer.hpp"
+#include "parallel.hpp"
+
+/*
+  Writes synthetic VLMCs in the same cereal format as the .bintree files, so
+  benchmarks can run without access to real data. Every VLMC is a
+  prefix-closed context tree and the output only depends on the settings and
+  the seed.
+*/
+namespace vlmc_generator {
+  using VLMCKmer = kmers::VLMCKmer;
+  using context_t = std::vector<unsigned char>;
+
+  enum Count_Distribution {
+    // Next symbol counts uniform in [0, max_count].
+    counts_uniform,
+    // Counts shrink by a factor four per level, as in trees built from sequences.
+    counts_geometric
+  };
+
+  struct Generator_Settings {
+    size_t nr_contexts = 1000;
+    // Fraction of the contexts that every generated VLMC shares.
+    double overlap = 0.5;
+    // All contexts up to this length are present, must be >= the background order used when loading.
+    size_t min_depth = 1;
+    size_t max_depth = 12;
+    // Probability that a candidate context is pruned together with its whole subtree.
+    double pruning = 0.0;
+    // Probability of extending the most recently added context instead of a random one, higher gives deeper trees.
+    double depth_bias = 0.0;
+    Count_Distribution count_distribution = Count_Distribution::counts_uniform;
+    kmers::uint64 max_count = 100;
+    unsigned long seed = 0;
+  };
+
+  struct Shared_Tree {
+    std::vector<context_t> contexts{};
+    std::vector<context_t> frontier{};
+  };
+
+  std::array<kmers::uint64, 4> next_symbol_counts(const Generator_Settings& settings, size_t depth, std::mt19937_64& rng) {
+    kmers::uint64 max_count = settings.max_count;
+    if (settings.count_distribution == Count_Distribution::counts_geometric) {
+      max_count = std::max(kmers::uint64(1), settings.max_count >> std::min(size_t(62), 2 * depth));
+    }
+    std::uniform_int_distribution<kmers::uint64> count_dist(0, max_count);
+    return { count_dist(rng), count_dist(rng), count_dist(rng), count_dist(rng) };
+  }
+
+  VLMCKmer make_kmer(const context_t& context, const Generator_Settings& settings, std::mt19937_64& rng) {
+    auto counts = next_symbol_counts(settings, context.size(), rng);
+
+    VLMCKmer kmer{ static_cast<kmers::uint32>(context.size()), counts[0] + counts[1] + counts[2] + counts[3], counts };
+    kmer.kmer_data = { 0, 0, 0, 0 };
+    for (size_t pos = 0; pos < context.size(); pos++) {
+      size_t row = pos >> 5;
+      size_t pos_in_row = pos & 31;
+      kmer.kmer_data[row] |= static_cast<kmers::uint64>(context[pos]) << (62 - pos_in_row * 2);
+    }
+    return kmer;
+  }
+
+  /*
+    Grows a prefix-closed context tree by repeatedly adding a child of a
+    context already in the tree until nr_contexts is reached or every
+    candidate has been pruned.
+  */
+  void grow(std::vector<context_t>& tree, std::vector<context_t>& frontier, size_t nr_contexts,
+    const Generator_Settings& settings, std::mt19937_64& rng) {
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    while (tree.size() < nr_contexts && !frontier.empty()) {
+      size_t idx = frontier.size() - 1;
+      if (coin(rng) >= settings.depth_bias) {
+        std::uniform_int_distribution<size_t> pick(0, frontier.size() - 1);
+        idx = pick(rng);
+      }
+      context_t context = std::move(frontier[idx]);
+      frontier[idx] = std::move(frontier.back());
+      frontier.pop_back();
+
+      if (coin(rng) < settings.pruning) {
+        continue;
+      }
+      if (context.size() < settings.max_depth) {
+        for (unsigned char c = 0; c < 4; c++) {
+          context_t child = context;
+          child.push_back(c);
+          frontier.push_back(std::move(child));
+        }
+      }
+      tree.push_back(std::move(context));
+    }
+  }
+
+  void complete_levels(std::vector<context_t>& tree, std::vector<context_t>& frontier, size_t depth) {
+    std::vector<context_t> level{ context_t{} };
+    for (size_t d = 0; d <= depth; d++) {
+      std::vector<context_t> next_level{};
+      for (auto& context : level) {
+        for (unsigned char c = 0; c < 4; c++) {
+          context_t child = context;
+          child.push_back(c);
+          next_level.push_back(child);
+        }
+        tree.push_back(context);
+      }
+      level = std::move(next_level);
+    }
+    frontier = std::move(level);
+  }
+
+  // Contexts shared by every VLMC generated with the same settings.
+  Shared_Tree shared_tree(const Generator_Settings& settings) {
+    std::mt19937_64 rng{ settings.seed };
+    Shared_Tree shared{};
+    complete_levels(shared.contexts, shared.frontier, settings.min_depth);
+    size_t nr_shared = std::max(shared.contexts.size(), size_t(settings.overlap * settings.nr_contexts));
+    grow(shared.contexts, shared.frontier, nr_shared, settings, rng);
+    return shared;
+  }
+
+  std::vector<VLMCKmer> generate_vlmc(const Generator_Settings& settings, const Shared_Tree& shared, size_t vlmc_index) {
+    auto tree = shared.contexts;
+    auto frontier = shared.frontier;
+
+    std::mt19937_64 rng{ settings.seed ^ (0x9E3779B97F4A7C15ul * (vlmc_index + 1)) };
+    grow(tree, frontier, settings.nr_contexts, settings, rng);
+
+    std::vector<VLMCKmer> kmers{};
+    kmers.reserve(tree.size());
+    for (auto& context : tree) {
+      kmers.push_back(make_kmer(context, settings, rng));
+    }
+    return kmers;
+  }
+
+  std::vector<VLMCKmer> generate_vlmc(const Generator_Settings& settings, size_t vlmc_index) {
+    return generate_vlmc(settings, shared_tree(settings), vlmc_index);
+  }
+
+  void write_vlmc(const std::filesystem::path& path, std::vector<VLMCKmer>& kmers) {
+    std::ofstream ofs(path, std::ios::binary);
+    cereal::BinaryOutputArchive archive(ofs);
+    for (auto& kmer : kmers) {
+      archive(kmer);
+    }
+  }
+
+  std::vector<std::filesystem::path> generate_directory(const std::filesystem::path& directory, size_t nr_vlmcs,
+    const Generator_Settings& settings, size_t nr_cores_to_use = 1) {
+    std::filesystem::create_directories(directory);
+    std::vector<std::filesystem::path> paths(nr_vlmcs);
+    for (size_t i = 0; i < nr_vlmcs; i++) {
+      paths[i] = directory / ("vlmc_" + std::to_string(i) + ".bintree");
+    }
+
+    auto shared = shared_tree(settings);
+    auto fun = [&](size_t start_index, size_t stop_index) {
+      for (size_t index = start_index; index < stop_index; index++) {
+        auto kmers = generate_vlmc(settings, shared, index);
+        write_vlmc(paths[index], kmers);
+      }
+    };
+    parallel::parallelize(nr_vlmcs, fun, std::max(size_t(1), nr_cores_to_use));
+
+    return paths;
+  }
+}
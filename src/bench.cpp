@@ -0,0 +1,618 @@
+#include <new>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <iostream>
+
+#include "parser.hpp"
+#include "get_cluster.hpp"
+#include "calc_dists.hpp"
+#include "benchmark.hpp"
+#include "vlmc_generator.hpp"
+#include "global_aliases.hpp"
+#include "perf_report.hpp"
+#include "hw_counters.hpp"
+#include "tree.hpp"
+
+/*
+  Microbenchmarks of the VLMC containers on generated data. For every container
+  it measures loading, single key lookups (hits and misses), pairwise
+  intersection and the full all-pairs dvstar computation. The containers with
+  batched search also measure their lookups through get_batch. With '--size-ratios'
+  it also intersects every VLMC with a VLMC that is ratio times larger, and
+  with '--tree-sizes' it times the tree building on random matrices.
+*/
+
+// Counts every heap allocation of the process, to compare the memory layouts of the containers.
+std::atomic<unsigned long> nr_allocations{ 0 };
+std::atomic<long> nr_live_allocations{ 0 };
+
+void* operator new(size_t size) {
+  nr_allocations++;
+  nr_live_allocations++;
+  if (void* p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc{};
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+  nr_allocations++;
+  nr_live_allocations++;
+  size_t align = static_cast<size_t>(alignment);
+  if (void* p = std::aligned_alloc(align, (std::max(size, size_t(1)) + align - 1) / align * align)) {
+    return p;
+  }
+  throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept {
+  if (p != nullptr) {
+    nr_live_allocations--;
+    std::free(p);
+  }
+}
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete(void* p, std::align_val_t) noexcept { operator delete(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { operator delete(p); }
+
+struct bench_arguments {
+  std::vector<size_t> sizes{ 1000, 10000 };
+  std::vector<double> overlaps{ 0.5 };
+  std::vector<size_t> max_depths{ 12 };
+  std::vector<size_t> size_ratios{};
+  std::vector<size_t> tree_sizes{};
+  size_t tree_cores{ 1 };
+  double filter_fpr{ 0.0 };
+  std::vector<size_t> threads{ 1 };
+  std::vector<parser::VLMC_Rep> containers{};
+  size_t nr_vlmcs{ 16 };
+  size_t repetitions{ 10 };
+  size_t warmup{ 1 };
+  size_t lookups{ 100000 };
+  size_t background_order{ 0 };
+  unsigned long seed{ 0 };
+  std::string format{ "csv" };
+  bool hw_counters{ false };
+  std::filesystem::path out_path{};
+  std::filesystem::path data_path{ std::filesystem::temp_directory_path() / "dvstar_bench" };
+};
+
+struct Dataset {
+  std::filesystem::path directory;
+  size_t size;
+  double overlap;
+  size_t max_depth;
+  size_t nr_kmers;
+  // (vlmc index, integer_rep) pairs.
+  std::vector<std::pair<size_t, int>> hits;
+  std::vector<std::pair<size_t, int>> misses;
+  // (size ratio, directory) of the larger VLMCs for the skewed intersections.
+  std::vector<std::pair<size_t, std::filesystem::path>> skewed{};
+};
+
+//------------------------------------------------//
+// Single key lookup, true if i_rep is in the VLMC //
+//------------------------------------------------//
+template <typename VC>
+bool sorted_lookup(VC& vlmc, int i_rep) {
+  auto it = std::lower_bound(vlmc.begin(), vlmc.end(), i_rep,
+    [](const kmers::RI_Kmer& kmer, int key) { return kmer.integer_rep < key; });
+  return it != vlmc.end() && it->integer_rep == i_rep;
+}
+
+bool lookup(vlmc_container::VLMC_sorted_vector& vlmc, int i_rep) { return sorted_lookup(vlmc, i_rep); }
+bool lookup(vlmc_container::VLMC_sorted_search& vlmc, int i_rep) { return sorted_lookup(vlmc, i_rep); }
+bool lookup(vlmc_container::VLMC_hashmap& vlmc, int i_rep) { return vlmc.container.find(i_rep) != vlmc.container.end(); }
+bool lookup(vlmc_container::VLMC_Eytzinger& vlmc, int i_rep) { return vlmc.get(i_rep).integer_rep == i_rep; }
+bool lookup(vlmc_container::VLMC_B_tree& vlmc, int i_rep) { return vlmc.get(i_rep).integer_rep == i_rep; }
+bool lookup(vlmc_container::VLMC_Veb& vlmc, int i_rep) { return vlmc.get(i_rep).integer_rep == i_rep; }
+bool lookup(vlmc_container::VLMC_S_tree& vlmc, int i_rep) { return vlmc.get(i_rep).integer_rep == i_rep; }
+bool lookup(vlmc_container::VLMC_rank_bitvector& vlmc, int i_rep) { return vlmc.arr.find(i_rep) >= 0; }
+bool lookup(vlmc_container::VLMC_context_trie& vlmc, int i_rep) { return vlmc.trie.find(i_rep) >= 0; }
+template <typename T>
+bool lookup(vlmc_container::VLMC_quantized<T>& vlmc, int i_rep) {
+  return std::binary_search(vlmc.arr.keys, vlmc.arr.keys + vlmc.arr.size, i_rep);
+}
+
+template <typename VC>
+constexpr bool has_get_batch = false;
+template <>
+constexpr bool has_get_batch<vlmc_container::VLMC_Eytzinger> = true;
+template <>
+constexpr bool has_get_batch<vlmc_container::VLMC_B_tree> = true;
+template <>
+constexpr bool has_get_batch<vlmc_container::VLMC_Veb> = true;
+template <>
+constexpr bool has_get_batch<vlmc_container::VLMC_S_tree> = true;
+
+// The keys of each VLMC, in the order of the lookups.
+std::vector<std::vector<int>> keys_by_vlmc(const std::vector<std::pair<size_t, int>>& keys, size_t nr_vlmcs) {
+  std::vector<std::vector<int>> by_vlmc(nr_vlmcs);
+  for (auto& [vlmc_i, key] : keys) {
+    by_vlmc[vlmc_i].push_back(key);
+  }
+  return by_vlmc;
+}
+
+std::filesystem::path generate(const bench_arguments& arguments, size_t size, double overlap, size_t max_depth) {
+  auto directory = arguments.data_path /
+    ("size_" + std::to_string(size) + "_overlap_" + std::to_string(overlap) + "_depth_" + std::to_string(max_depth));
+
+  vlmc_generator::Generator_Settings settings{};
+  settings.nr_contexts = size;
+  settings.overlap = overlap;
+  settings.min_depth = arguments.background_order;
+  settings.max_depth = max_depth;
+  settings.seed = arguments.seed;
+  std::filesystem::remove_all(directory);
+  vlmc_generator::generate_directory(directory, arguments.nr_vlmcs, settings, std::thread::hardware_concurrency());
+  return directory;
+}
+
+Dataset make_dataset(const bench_arguments& arguments, size_t size, double overlap, size_t max_depth) {
+  Dataset data{};
+  data.size = size;
+  data.overlap = overlap;
+  data.max_depth = max_depth;
+  data.directory = generate(arguments, size, overlap, max_depth);
+  // With the same seed the shared contexts of the larger VLMCs are a superset of the smaller ones.
+  for (auto ratio : arguments.size_ratios) {
+    data.skewed.emplace_back(ratio, generate(arguments, size * ratio, overlap, max_depth));
+  }
+
+  // The sorted vector gives the reference key sets for the lookups.
+  auto cluster = get_cluster::get_cluster<vlmc_container::VLMC_sorted_vector>(data.directory, 1, arguments.background_order);
+  std::mt19937_64 rng{ arguments.seed };
+  std::uniform_int_distribution<size_t> pick_vlmc(0, cluster.size() - 1);
+  data.nr_kmers = 0;
+  for (size_t i = 0; i < cluster.size(); i++) {
+    data.nr_kmers += cluster[i].size();
+  }
+  while (data.hits.size() < arguments.lookups) {
+    auto vlmc_i = pick_vlmc(rng);
+    auto& vlmc = cluster.get(vlmc_i);
+    std::uniform_int_distribution<size_t> pick_kmer(0, vlmc.size() - 1);
+    data.hits.emplace_back(vlmc_i, vlmc.get(pick_kmer(rng)).integer_rep);
+  }
+  while (data.misses.size() < arguments.lookups) {
+    auto vlmc_i = pick_vlmc(rng);
+    auto& vlmc = cluster.get(vlmc_i);
+    std::uniform_int_distribution<int> pick_key(vlmc.get(0).integer_rep, vlmc.get(vlmc.size() - 1).integer_rep + 1);
+    auto key = pick_key(rng);
+    if (!sorted_lookup(vlmc, key)) {
+      data.misses.emplace_back(vlmc_i, key);
+    }
+  }
+  return data;
+}
+
+std::unique_ptr<hw_counters::Collector> hw_collector{};
+
+/*
+  Times fun and, with '--hw-counters', runs it once more under the hardware
+  counters. Probes and matched contexts are taken from the perf counters
+  unless given.
+*/
+template <typename Fun>
+void run_measure(std::vector<benchmark::Result>& results, const std::string& container, const std::string& measure,
+  const Dataset& data, size_t ops, const bench_arguments& arguments, Fun&& fun, double probes = 0.0, double matched = 0.0) {
+  auto samples = benchmark::repeat(arguments.repetitions, arguments.warmup, fun);
+  benchmark::Result result{ container, measure, data.size, data.overlap, ops, arguments.repetitions, benchmark::summarise(samples) };
+  result.max_depth = data.max_depth;
+  if (hw_collector) {
+    auto before = perf::totals();
+    result.hw = hw_counters::measure(*hw_collector, fun);
+    auto after = perf::totals();
+    result.probes = probes > 0 ? probes : after[perf::Counter::probes] - before[perf::Counter::probes];
+    result.matched = matched > 0 ? matched : after[perf::Counter::matched_contexts] - before[perf::Counter::matched_contexts];
+  }
+  results.push_back(result);
+}
+
+// Runs load and records the allocations it made, the allocations its result holds and the memory it added.
+template <typename Load>
+auto measure_memory(benchmark::Result& result, Load&& load) {
+  auto allocations = nr_allocations.load();
+  auto live_allocations = nr_live_allocations.load();
+  auto rss_kb = benchmark::current_rss_kb();
+  auto loaded = load();
+  result.allocations = nr_allocations.load() - allocations;
+  result.live_allocations = nr_live_allocations.load() - live_allocations;
+  result.rss_kb = benchmark::current_rss_kb() - rss_kb;
+  return loaded;
+}
+
+/*
+  Splits a load into the construction phases it times: every repetition
+  loads with the phase timers on, and the wall seconds each phase added are
+  recorded as load_<phase>.
+*/
+template <typename Load>
+void measure_load_phases(std::vector<benchmark::Result>& results, const std::string& container, const Dataset& data,
+  const bench_arguments& arguments, Load&& load) {
+  constexpr std::array<perf::Phase, 4> phases{ perf::phase_parse, perf::phase_sort, perf::phase_background, perf::phase_layout };
+  std::array<std::vector<double>, phases.size()> samples{};
+  bool was_enabled = perf::enabled;
+  perf::enabled = true;
+  for (size_t r = 0; r < arguments.repetitions; r++) {
+    auto before = perf::phase_wall_seconds();
+    load();
+    auto after = perf::phase_wall_seconds();
+    for (size_t p = 0; p < phases.size(); p++) {
+      samples[p].push_back(after[phases[p]] - before[phases[p]]);
+    }
+  }
+  perf::enabled = was_enabled;
+  for (size_t p = 0; p < phases.size(); p++) {
+    benchmark::Result result{ container, std::string("load_") + perf::phase_names[phases[p]], data.size, data.overlap,
+      data.nr_kmers, arguments.repetitions, benchmark::summarise(samples[p]) };
+    result.max_depth = data.max_depth;
+    results.push_back(result);
+  }
+}
+
+template <typename VC>
+unsigned long intersect(VC& left, VC& right) {
+  unsigned long matched = 0;
+  auto f = [&](const kmers::RI_Kmer& left_kmer, const kmers::RI_Kmer& right_kmer) { matched++; };
+  if (left.size() < right.size()) {
+    vlmc_container::iterate_kmers(left, right, f);
+  }
+  else {
+    vlmc_container::iterate_kmers(right, left, f);
+  }
+  perf::count(perf::Counter::matched_contexts, matched);
+  return matched;
+}
+
+template <typename VC>
+void bench_container(const std::string& name, const Dataset& data, const bench_arguments& arguments,
+  std::vector<benchmark::Result>& results);
+
+/*
+  All pairs of two clusters through calculate_full_slice, with the block
+  kernel and pairwise (_pairwise). The square tile is the cluster against
+  itself, the skinny one its first VLMC against all of it.
+*/
+template <typename VC>
+void bench_tiles(const std::string& name, const Dataset& data, const bench_arguments& arguments,
+  cluster_container::Cluster_Container<VC>& cluster, std::vector<benchmark::Result>& results) {
+  cluster_container::Cluster_Container<VC> first{};
+  first.push(cluster.get(0));
+  distance::metric::metric_list<distance::metric::Dvstar> dvstar{};
+  for (bool block : { true, false }) {
+    std::string suffix = block ? "" : "_pairwise";
+    run_measure(results, name, "tile_square" + suffix, data, cluster.size() * cluster.size(), arguments, [&]() {
+      calc_dist::calculate_distances<VC>(cluster, cluster, 1, dvstar, block);
+    });
+    run_measure(results, name, "tile_skinny" + suffix, data, cluster.size(), arguments, [&]() {
+      calc_dist::calculate_distances<VC>(first, cluster, 1, dvstar, block);
+    });
+  }
+}
+
+// With '--filter-fpr' the containers that consult a filter are measured once more with filters, as <name>+filter.
+template <typename VC>
+void bench_with_filter(const std::string& name, const Dataset& data, const bench_arguments& arguments,
+  std::vector<benchmark::Result>& results) {
+  bench_container<VC>(name, data, arguments, results);
+  if (arguments.filter_fpr > 0.0) {
+    bloom::false_positive_rate = arguments.filter_fpr;
+    bench_container<VC>(name + "+filter", data, arguments, results);
+    bloom::false_positive_rate = 0.0;
+  }
+}
+
+// Operations of the intersection and dvstar measures, whatever an engine computes to produce them.
+size_t unique_pairs(size_t nr_vlmcs) {
+  return nr_vlmcs * (nr_vlmcs - 1) / 2;
+}
+
+template <typename VC>
+void bench_container(const std::string& name, const Dataset& data, const bench_arguments& arguments,
+  std::vector<benchmark::Result>& results) {
+  run_measure(results, name, "load", data, data.nr_kmers, arguments, [&]() {
+    get_cluster::get_cluster<VC>(data.directory, 1, arguments.background_order);
+  }, data.nr_kmers);
+
+  auto cluster = measure_memory(results.back(), [&]() {
+    return get_cluster::get_cluster<VC>(data.directory, 1, arguments.background_order);
+  });
+  measure_load_phases(results, name, data, arguments, [&]() {
+    get_cluster::get_cluster<VC>(data.directory, 1, arguments.background_order);
+  });
+
+  size_t found = 0;
+  for (auto* keys : { &data.hits, &data.misses }) {
+    bool hits = keys == &data.hits;
+    run_measure(results, name, hits ? "lookup_hit" : "lookup_miss", data, keys->size(), arguments, [&]() {
+      for (auto& [vlmc_i, key] : *keys) {
+        found += lookup(cluster.get(vlmc_i), key);
+      }
+    }, keys->size(), hits ? keys->size() : 0.0);
+
+    if constexpr (has_get_batch<VC>) {
+      auto by_vlmc = keys_by_vlmc(*keys, cluster.size());
+      run_measure(results, name, hits ? "lookup_hit_batched" : "lookup_miss_batched", data, keys->size(), arguments, [&]() {
+        for (size_t vlmc_i = 0; vlmc_i < by_vlmc.size(); vlmc_i++) {
+          cluster.get(vlmc_i).get_batch(by_vlmc[vlmc_i].data(), by_vlmc[vlmc_i].size(),
+            [&](int k, kmers::RI_Kmer& kmer) { found++; });
+        }
+      }, keys->size(), hits ? keys->size() : 0.0);
+    }
+  }
+
+  size_t nr_pairs = unique_pairs(cluster.size());
+  size_t matched = 0;
+  run_measure(results, name, "intersection", data, nr_pairs, arguments, [&]() {
+    for (size_t i = 0; i < cluster.size(); i++) {
+      for (size_t j = i + 1; j < cluster.size(); j++) {
+        matched += intersect(cluster.get(i), cluster.get(j));
+      }
+    }
+  });
+
+  for (auto& [ratio, directory] : data.skewed) {
+    auto large = get_cluster::get_cluster<VC>(directory, 1, arguments.background_order);
+    run_measure(results, name, "intersection_x" + std::to_string(ratio), data, cluster.size(), arguments, [&]() {
+      for (size_t i = 0; i < cluster.size(); i++) {
+        matched += intersect(cluster.get(i), large.get(i));
+      }
+    });
+  }
+
+  run_measure(results, name, "dvstar", data, nr_pairs, arguments, [&]() {
+    calc_dist::calculate_distances<VC>(cluster, 1);
+  });
+  if constexpr (vlmc_container::has_sorted_kmers<VC>) {
+    bench_tiles<VC>(name, data, arguments, cluster, results);
+  }
+
+  // Keeps the lookups and intersections from being optimised away.
+  if (found + matched == 0) {
+    std::cerr << "Warning: no lookups or intersections matched for " << name << std::endl;
+  }
+}
+
+// Measures with more than one thread are suffixed with the number of threads.
+std::string threads_measure(const std::string& measure, size_t nr_threads) {
+  return nr_threads == 1 ? measure : measure + "_t" + std::to_string(nr_threads);
+}
+
+void bench_kmer_major(const Dataset& data, const bench_arguments& arguments, std::vector<benchmark::Result>& results) {
+  run_measure(results, "kmer-major", "load", data, data.nr_kmers, arguments, [&]() {
+    get_cluster::get_kmer_cluster(data.directory, 1, arguments.background_order);
+  }, data.nr_kmers);
+
+  measure_memory(results.back(), [&]() {
+    return get_cluster::get_kmer_cluster(data.directory, 1, arguments.background_order);
+  });
+  size_t nr_pairs = unique_pairs(arguments.nr_vlmcs);
+  for (auto nr_threads : arguments.threads) {
+    // The groups of VLMCs are the unit of parallelism, so there is one group per thread.
+    auto grouped = get_cluster::get_kmer_cluster(data.directory, nr_threads, arguments.background_order);
+    run_measure(results, "kmer-major", threads_measure("dvstar", nr_threads), data, nr_pairs, arguments, [&]() {
+      calc_dist::calculate_distance_major(grouped, grouped, nr_threads);
+    });
+  }
+}
+
+void bench_kmer_partitioned(const Dataset& data, const bench_arguments& arguments, std::vector<benchmark::Result>& results) {
+  using VC = vlmc_container::VLMC_sorted_vector;
+  run_measure(results, "kmer-partitioned", "load", data, data.nr_kmers, arguments, [&]() {
+    get_cluster::get_cluster<VC>(data.directory, 1, arguments.background_order);
+  }, data.nr_kmers);
+
+  auto cluster = measure_memory(results.back(), [&]() {
+    return get_cluster::get_cluster<VC>(data.directory, 1, arguments.background_order);
+  });
+  size_t nr_pairs = unique_pairs(cluster.size());
+  for (auto nr_threads : arguments.threads) {
+    run_measure(results, "kmer-partitioned", threads_measure("dvstar", nr_threads), data, nr_pairs, arguments, [&]() {
+      calc_dist::calculate_partitioned(cluster, nr_threads, distance::metric::metric_list<distance::metric::Dvstar>{});
+    });
+  }
+}
+
+/*
+  The first VLMC as a query against all VLMCs of the dataset as references,
+  with query tables and with the pairwise sbs path of '-p query -s references'.
+  One operation is one query, so ops_per_s gives queries per second.
+*/
+void bench_query_table(const Dataset& data, const bench_arguments& arguments, std::vector<benchmark::Result>& results) {
+  using VC = vlmc_container::VLMC_sorted_vector;
+  using SBS = vlmc_container::VLMC_sorted_search;
+  run_measure(results, "query-table", "load", data, data.nr_kmers, arguments, [&]() {
+    get_cluster::get_cluster<VC>(data.directory, 1, arguments.background_order);
+  }, data.nr_kmers);
+
+  auto references = measure_memory(results.back(), [&]() {
+    return get_cluster::get_cluster<VC>(data.directory, 1, arguments.background_order);
+  });
+  cluster_container::Cluster_Container<VC> queries{};
+  queries.push(references.get(0));
+  auto sbs_references = get_cluster::get_cluster<SBS>(data.directory, 1, arguments.background_order);
+  cluster_container::Cluster_Container<SBS> sbs_queries{};
+  sbs_queries.push(sbs_references.get(0));
+  for (auto nr_threads : arguments.threads) {
+    run_measure(results, "query-table", threads_measure("one_vs_many", nr_threads), data, queries.size(), arguments, [&]() {
+      calc_dist::calculate_query_tables(queries, references, false, nr_threads, distance::metric::metric_list<distance::metric::Dvstar>{});
+    });
+    run_measure(results, "sbs", threads_measure("one_vs_many", nr_threads), data, sbs_queries.size(), arguments, [&]() {
+      calc_dist::calculate_distances<SBS>(sbs_queries, sbs_references, nr_threads, distance::metric::metric_list<distance::metric::Dvstar>{});
+    });
+  }
+}
+
+// Distances between random points in 8 dimensions, which are far from tree-like and so a hard case for the NJ bounds.
+matrix_t random_distances(size_t n, unsigned long seed) {
+  std::mt19937_64 rng{ seed };
+  std::uniform_real_distribution<double> coordinate(0.0, 1.0);
+  Eigen::MatrixXd points(n, 8);
+  for (Eigen::Index i = 0; i < points.size(); i++) {
+    points.data()[i] = coordinate(rng);
+  }
+  matrix_t distances(n, n);
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = 0; j < n; j++) {
+      distances(i, j) = (points.row(i) - points.row(j)).norm();
+    }
+  }
+  return distances;
+}
+
+// Times both tree methods on n taxa, including the copy of the matrix they build in.
+void bench_tree(size_t n, const bench_arguments& arguments, std::vector<benchmark::Result>& results) {
+  std::cerr << "Benchmarking tree (taxa " << n << ")" << std::endl;
+  Dataset data{ {}, n, 0.0, 0, 0 };
+  auto distances = random_distances(n, arguments.seed);
+  size_t nr_joins = n > 2 ? n - 2 : 1;
+  run_measure(results, "tree", "tree_nj", data, nr_joins, arguments, [&]() {
+    tree::build(distances, tree::Method::method_nj, arguments.tree_cores);
+  });
+  run_measure(results, "tree", "tree_upgma", data, nr_joins, arguments, [&]() {
+    tree::build(distances, tree::Method::method_upgma, arguments.tree_cores);
+  });
+}
+
+void bench_dataset(const Dataset& data, const bench_arguments& arguments, std::vector<benchmark::Result>& results) {
+  auto rep_map = parser::vlmc_rep_map();
+  for (auto& [name, rep] : rep_map) {
+    if (!arguments.containers.empty() &&
+      std::find(arguments.containers.begin(), arguments.containers.end(), rep) == arguments.containers.end()) {
+      continue;
+    }
+    std::cerr << "Benchmarking " << name << " (size " << data.size << ", overlap " << data.overlap << ", max depth "
+      << data.max_depth << ")" << std::endl;
+    if (rep == parser::VLMC_Rep::vlmc_sorted_vector) {
+      bench_container<vlmc_container::VLMC_sorted_vector>(name, data, arguments, results);
+    }
+    else if (rep == parser::VLMC_Rep::vlmc_b_tree) {
+      bench_with_filter<vlmc_container::VLMC_B_tree>(name, data, arguments, results);
+    }
+    else if (rep == parser::VLMC_Rep::vlmc_hashmap) {
+      bench_with_filter<vlmc_container::VLMC_hashmap>(name, data, arguments, results);
+    }
+    else if (rep == parser::VLMC_Rep::vlmc_veb) {
+      bench_with_filter<vlmc_container::VLMC_Veb>(name, data, arguments, results);
+    }
+    else if (rep == parser::VLMC_Rep::vlmc_ey) {
+      bench_with_filter<vlmc_container::VLMC_Eytzinger>(name, data, arguments, results);
+    }
+    else if (rep == parser::VLMC_Rep::vlmc_s_tree) {
+      bench_with_filter<vlmc_container::VLMC_S_tree>(name, data, arguments, results);
+    }
+    else if (rep == parser::VLMC_Rep::vlmc_sorted_search) {
+      bench_container<vlmc_container::VLMC_sorted_search>(name, data, arguments, results);
+    }
+    else if (rep == parser::VLMC_Rep::vlmc_quantized_16) {
+      bench_container<vlmc_container::VLMC_quantized<int16_t>>(name, data, arguments, results);
+    }
+    else if (rep == parser::VLMC_Rep::vlmc_quantized_8) {
+      bench_container<vlmc_container::VLMC_quantized<int8_t>>(name, data, arguments, results);
+    }
+    else if (rep == parser::VLMC_Rep::vlmc_rank_bitvector) {
+      bench_container<vlmc_container::VLMC_rank_bitvector>(name, data, arguments, results);
+    }
+    else if (rep == parser::VLMC_Rep::vlmc_context_trie) {
+      bench_container<vlmc_container::VLMC_context_trie>(name, data, arguments, results);
+    }
+    else if (rep == parser::VLMC_Rep::vlmc_kmer_major) {
+      bench_kmer_major(data, arguments, results);
+    }
+    else if (rep == parser::VLMC_Rep::vlmc_kmer_partitioned) {
+      bench_kmer_partitioned(data, arguments, results);
+    }
+    else if (rep == parser::VLMC_Rep::vlmc_query_table) {
+      bench_query_table(data, arguments, results);
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  CLI::App app{"Microbenchmarks of the VLMC containers on generated VLMCs."};
+
+  bench_arguments arguments{};
+  app.add_option("--sizes", arguments.sizes, "Comma separated number of contexts per VLMC.")->delimiter(',');
+  app.add_option("--overlaps", arguments.overlaps, "Comma separated fraction of contexts shared between VLMCs.")->delimiter(',');
+  app.add_option("--max-depths", arguments.max_depths,
+    "Comma separated maximum context lengths of the generated VLMCs, shallower VLMCs have denser key ranges, at most 15. Default 12.")->delimiter(',')->check(CLI::Range(1, 15));
+  app.add_option("--size-ratios", arguments.size_ratios,
+    "Comma separated size ratios, adds intersections of each VLMC with one ratio times larger.")->delimiter(',');
+  app.add_option("--tree-sizes", arguments.tree_sizes,
+    "Comma separated numbers of taxa, times NJ and UPGMA tree building on random distance matrices of these sizes.")->delimiter(',');
+  app.add_option("-t,--threads", arguments.threads,
+    "Comma separated thread counts of the kmer-major and kmer-partitioned dvstar and the one_vs_many measures, for strong scaling. Default 1.")->delimiter(',');
+  app.add_option("--filter-fpr", arguments.filter_fpr,
+    "Also measure the eytzinger, b-tree, veb, s-tree and hashmap containers with Bloom filters of this false positive rate.")
+    ->check(CLI::Range(0.0, 0.5));
+  app.add_option("--tree-cores", arguments.tree_cores, "Threads of the NJ tree building. Default 1.");
+  app.add_option("-v,--vlmc-rep", arguments.containers, "Comma separated containers to benchmark. Default all.")
+    ->delimiter(',')
+    ->transform(CLI::CheckedTransformer(parser::vlmc_rep_map(), CLI::ignore_case));
+  app.add_option("-c,--count", arguments.nr_vlmcs, "Number of VLMCs per dataset.");
+  app.add_option("-r,--repetitions", arguments.repetitions, "Timed repetitions per measurement.");
+  app.add_option("-w,--warmup", arguments.warmup, "Untimed repetitions before measuring.");
+  app.add_option("-l,--lookups", arguments.lookups, "Number of hit and miss lookups.");
+  app.add_option("-b,--background-order", arguments.background_order, "Background order.");
+  app.add_option("--seed", arguments.seed, "Seed of the generated data.");
+  app.add_option("-f,--format", arguments.format, "Output format, 'csv' or 'json'.")
+    ->check(CLI::IsMember({ "csv", "json" }));
+  app.add_option("-o,--out", arguments.out_path, "Output file, stdout if left empty.");
+  app.add_option("-d,--data-path", arguments.data_path, "Directory for the generated VLMCs.");
+  app.add_flag("--hw-counters", arguments.hw_counters,
+    "Add cache, TLB and branch misses per probe and per matched context (Linux perf_event_open).");
+
+  try {
+    app.parse(argc, argv);
+  }
+  catch (const CLI::ParseError& e) {
+    return app.exit(e);
+  }
+  if (arguments.nr_vlmcs < 2 || arguments.repetitions < 1) {
+    std::cerr << "Error: at least two VLMCs and one repetition are required." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (arguments.hw_counters) {
+    perf::enabled = true;
+    hw_collector = std::make_unique<hw_counters::Collector>();
+    if (!hw_collector->available()) {
+      hw_collector.reset();
+    }
+  }
+
+  std::vector<benchmark::Result> results{};
+  for (auto size : arguments.sizes) {
+    for (auto overlap : arguments.overlaps) {
+      for (auto max_depth : arguments.max_depths) {
+        auto data = make_dataset(arguments, size, overlap, max_depth);
+        bench_dataset(data, arguments, results);
+        std::filesystem::remove_all(data.directory);
+        for (auto& [ratio, directory] : data.skewed) {
+          std::filesystem::remove_all(directory);
+        }
+      }
+    }
+  }
+  for (auto n : arguments.tree_sizes) {
+    bench_tree(n, arguments, results);
+  }
+
+  std::ofstream out_file{};
+  if (!arguments.out_path.empty()) {
+    out_file.open(arguments.out_path);
+  }
+  std::ostream& os = arguments.out_path.empty() ? std::cout : out_file;
+  if (arguments.format == "json") {
+    benchmark::write_json(os, results);
+  }
+  else {
+    benchmark::write_csv(os, results);
+  }
+
+  return EXIT_SUCCESS;
+}
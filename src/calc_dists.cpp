@@ -7,57 +7,319 @@
 #include "calc_dists.hpp"
 #include "global_aliases.hpp"
 #include "utils.hpp"
+#include "perf_report.hpp"
+#include "hw_counters.hpp"
+#include "trace.hpp"
+#include "numa.hpp"
+#include "shard.hpp"
+#include "shard_file.hpp"
+#include "tree.hpp"
+#include "catalog.hpp"
+#include "bundle.hpp"
 
-matrix_t calculate_kmer_major(parser::cli_arguments arguments, const size_t nr_cores) {
+using distances_t = calc_dist::distances_t;
+
+std::unique_ptr<hw_counters::Collector> hw_collector{};
+
+// The dvstar metric keeps its original dataset name so existing readers are unaffected.
+std::string dataset_name(const std::string& metric_name) {
+  if (metric_name == distance::metric::Dvstar::name) {
+    return "distances";
+  }
+  return metric_name;
+}
+
+/*
+  Runs fun and, with '--hw-counters', records the hardware counters of the phase
+  normalised by the k-mers loaded, probes and matched contexts counted meanwhile.
+*/
+template <typename Fun>
+auto record_hw_counters(const std::string& phase, Fun&& fun) {
+  if (!hw_collector) {
+    return fun();
+  }
+  auto before = perf::totals();
+  hw_collector->start();
+  auto result = fun();
+  auto sample = hw_collector->stop();
+  auto after = perf::totals();
+
+  double loaded = after[perf::Counter::kmers_loaded] - before[perf::Counter::kmers_loaded];
+  double probes = after[perf::Counter::probes] - before[perf::Counter::probes];
+  double matched = after[perf::Counter::matched_contexts] - before[perf::Counter::matched_contexts];
+  std::string json{};
+  if (phase == "load") {
+    json = hw_counters::to_json(sample, { { { "kmer", loaded }, { "match", 0.0 } } });
+  }
+  else {
+    json = hw_counters::to_json(sample, { { { "probe", probes }, { "match", matched } } });
+  }
+  perf::registry.add_section("hw_counters_" + phase, json);
+  std::cout << "Hardware counters (" << phase << "): " << json << std::endl;
+  return result;
+}
+
+template <typename... Metrics>
+distances_t calculate_kmer_major(parser::cli_arguments arguments, const size_t nr_cores, distance::metric::metric_list<Metrics...> metrics,
+  std::vector<std::filesystem::path>* loaded_paths = nullptr) {
   size_t use_cores = nr_cores;
   size_t max_cores = std::thread::hardware_concurrency();
   if (max_cores < nr_cores) {
     use_cores = max_cores;
   }
 
-  auto cluster = get_cluster::get_kmer_cluster(arguments.first_VLMC_path, use_cores, arguments.background_order, arguments.set_size);
+  auto cluster = record_hw_counters("load", [&]() {
+    return get_cluster::get_kmer_cluster(arguments.first_VLMC_path, use_cores, arguments.background_order, arguments.set_size, loaded_paths);
+  });
   if (arguments.second_VLMC_path.empty()) {
     std::cout << "Calculating distances for single cluster." << std::endl;
-    return calc_dist::calculate_distance_major(cluster, cluster, use_cores);
+    return record_hw_counters("distance", [&]() {
+      return calc_dist::calculate_distance_major(cluster, cluster, use_cores, metrics);
+    });
   }
-  auto cluster_to = get_cluster::get_kmer_cluster(arguments.second_VLMC_path, use_cores, arguments.background_order, arguments.set_size);
+  auto cluster_to = record_hw_counters("load_secondary", [&]() {
+    return get_cluster::get_kmer_cluster(arguments.second_VLMC_path, use_cores, arguments.background_order, arguments.set_size);
+  });
   std::cout << "Calculating distances." << std::endl;
-  return calc_dist::calculate_distance_major(cluster, cluster_to, use_cores);
+  return record_hw_counters("distance", [&]() {
+    return calc_dist::calculate_distance_major(cluster, cluster_to, use_cores, metrics);
+  });
+}
+
+template <typename... Metrics>
+distances_t calculate_kmer_partitioned(parser::cli_arguments arguments, const size_t nr_cores, distance::metric::metric_list<Metrics...> metrics,
+  std::vector<std::filesystem::path>* loaded_paths = nullptr) {
+  using VC = vlmc_container::VLMC_sorted_vector;
+  auto cluster = record_hw_counters("load", [&]() {
+    return get_cluster::get_cluster<VC>(arguments.first_VLMC_path, nr_cores, arguments.background_order, arguments.set_size, loaded_paths);
+  });
+  if (arguments.second_VLMC_path.empty()) {
+    std::cout << "Calculating distances for single cluster over partitioned contexts." << std::endl;
+    return record_hw_counters("distance", [&]() {
+      return calc_dist::calculate_partitioned(cluster, nr_cores, metrics);
+    });
+  }
+  auto cluster_to = record_hw_counters("load_secondary", [&]() {
+    return get_cluster::get_cluster<VC>(arguments.second_VLMC_path, nr_cores, arguments.background_order, arguments.set_size);
+  });
+  std::cout << "Calculating distances over partitioned contexts." << std::endl;
+  return record_hw_counters("distance", [&]() {
+    return calc_dist::calculate_partitioned(cluster, cluster_to, false, nr_cores, metrics);
+  });
+}
+
+/*
+  Compares every VLMC of the primary directory, the queries, with every VLMC
+  of the secondary directory through query tables, or the primary directory
+  with itself.
+*/
+template <typename... Metrics>
+distances_t calculate_query_tables(parser::cli_arguments arguments, const size_t nr_cores, distance::metric::metric_list<Metrics...> metrics,
+  std::vector<std::filesystem::path>* loaded_paths = nullptr) {
+  using VC = vlmc_container::VLMC_sorted_vector;
+  auto cluster = record_hw_counters("load", [&]() {
+    return get_cluster::get_cluster<VC>(arguments.first_VLMC_path, nr_cores, arguments.background_order, arguments.set_size, loaded_paths);
+  });
+  if (arguments.second_VLMC_path.empty()) {
+    std::cout << "Calculating distances for single cluster with query tables." << std::endl;
+    return record_hw_counters("distance", [&]() {
+      return calc_dist::calculate_query_tables(cluster, nr_cores, metrics);
+    });
+  }
+  auto cluster_to = record_hw_counters("load_secondary", [&]() {
+    return get_cluster::get_cluster<VC>(arguments.second_VLMC_path, nr_cores, arguments.background_order, arguments.set_size);
+  });
+  std::cout << "Calculating distances of " << cluster.size() << " queries to " << cluster_to.size() << " references." << std::endl;
+  return record_hw_counters("distance", [&]() {
+    return calc_dist::calculate_query_tables(cluster, cluster_to, false, nr_cores, metrics);
+  });
+}
+
+/*
+  Computes the tiles of the shard given by '--shard' and writes them to the
+  output file. Returns no matrices, the shards are assembled by 'merge'.
+*/
+template <typename VC, typename... Metrics>
+distances_t calculate_shard(parser::cli_arguments arguments, cluster_container::Cluster_Container<VC>& cluster_left,
+  cluster_container::Cluster_Container<VC>& cluster_right, bool triangle, const size_t nr_cores,
+  distance::metric::metric_list<Metrics...> metrics) {
+  auto spec = shard::parse(arguments.shard);
+  auto tiles = shard::shard_tiles(cluster_left.size(), cluster_right.size(), triangle, spec);
+  std::cout << "Calculating " << tiles.size() << " tiles of shard " << spec.index << "/" << spec.count << std::endl;
+  auto tile_distances = record_hw_counters("distance", [&]() {
+    return calc_dist::calculate_tiles<VC>(tiles, triangle, cluster_left, cluster_right, nr_cores, metrics);
+  });
+
+  perf::Phase_Timer timer{ perf::Phase::phase_hdf5_write };
+  trace::Scope span{ "hdf5_write" };
+  std::vector<std::string> names{};
+  for (auto& name : distance::metric::names(metrics)) {
+    names.push_back(dataset_name(name));
+  }
+  shard_file::write(arguments.out_path, spec, cluster_left.size(), cluster_right.size(), triangle, tiles, tile_distances, names);
+  return {};
 }
 
-template <typename VC>
-matrix_t calculate_cluster_distance(parser::cli_arguments arguments, const size_t nr_cores) {
-  auto cluster = get_cluster::get_cluster<VC>(arguments.first_VLMC_path, nr_cores, arguments.background_order, arguments.set_size);
+template <typename VC, typename... Metrics>
+distances_t calculate_cluster_distance(parser::cli_arguments arguments, const size_t nr_cores, distance::metric::metric_list<Metrics...> metrics,
+  std::vector<std::filesystem::path>* loaded_paths = nullptr) {
+  auto cluster = record_hw_counters("load", [&]() {
+    return get_cluster::get_cluster<VC>(arguments.first_VLMC_path, nr_cores, arguments.background_order, arguments.set_size, loaded_paths);
+  });
   if (arguments.second_VLMC_path.empty()) {
+    if (!arguments.shard.empty()) {
+      return calculate_shard<VC>(arguments, cluster, cluster, true, nr_cores, metrics);
+    }
     std::cout << "Calculating distances for single cluster of size " << cluster.size() << std::endl;
-    return calc_dist::calculate_distances<VC>(cluster, nr_cores);
+    return record_hw_counters("distance", [&]() {
+      return calc_dist::calculate_distances<VC>(cluster, nr_cores, metrics);
+    });
+  }
+  auto cluster_to = record_hw_counters("load_secondary", [&]() {
+    return get_cluster::get_cluster<VC>(arguments.second_VLMC_path, nr_cores, arguments.background_order, arguments.set_size);
+  });
+  if (!arguments.shard.empty()) {
+    return calculate_shard<VC>(arguments, cluster, cluster_to, false, nr_cores, metrics);
   }
-  auto cluster_to = get_cluster::get_cluster<VC>(arguments.second_VLMC_path, nr_cores, arguments.background_order, arguments.set_size);
   std::cout << "Calculating distances matrix of size " << cluster.size() << "x" << cluster_to.size() << std::endl;
-  return calc_dist::calculate_distances<VC>(cluster, cluster_to, nr_cores);
+  return record_hw_counters("distance", [&]() {
+    return calc_dist::calculate_distances<VC>(cluster, cluster_to, nr_cores, metrics);
+  });
 }
 
-matrix_t apply_container(parser::cli_arguments arguments, parser::VLMC_Rep vlmc_container, const size_t nr_cores) {
+template <typename... Metrics>
+distances_t apply_container(parser::cli_arguments arguments, parser::VLMC_Rep vlmc_container, const size_t nr_cores,
+  distance::metric::metric_list<Metrics...> metrics, std::vector<std::filesystem::path>* loaded_paths = nullptr) {
   if (vlmc_container == parser::VLMC_Rep::vlmc_sorted_vector) {
-    return calculate_cluster_distance<vlmc_container::VLMC_sorted_vector>(arguments, nr_cores);
+    return calculate_cluster_distance<vlmc_container::VLMC_sorted_vector>(arguments, nr_cores, metrics, loaded_paths);
   }
   else if (vlmc_container == parser::VLMC_Rep::vlmc_b_tree) {
-    return calculate_cluster_distance<vlmc_container::VLMC_B_tree>(arguments, nr_cores);
+    return calculate_cluster_distance<vlmc_container::VLMC_B_tree>(arguments, nr_cores, metrics, loaded_paths);
   }
   else if (vlmc_container == parser::VLMC_Rep::vlmc_hashmap) {
-    return calculate_cluster_distance<vlmc_container::VLMC_hashmap>(arguments, nr_cores);
+    return calculate_cluster_distance<vlmc_container::VLMC_hashmap>(arguments, nr_cores, metrics, loaded_paths);
   }
   else if (vlmc_container == parser::VLMC_Rep::vlmc_veb) {
-    return calculate_cluster_distance<vlmc_container::VLMC_Veb>(arguments, nr_cores);
+    return calculate_cluster_distance<vlmc_container::VLMC_Veb>(arguments, nr_cores, metrics, loaded_paths);
   }
   else if (vlmc_container == parser::VLMC_Rep::vlmc_ey) {
-    return calculate_cluster_distance<vlmc_container::VLMC_Eytzinger>(arguments, nr_cores);
+    return calculate_cluster_distance<vlmc_container::VLMC_Eytzinger>(arguments, nr_cores, metrics, loaded_paths);
+  }
+  else if (vlmc_container == parser::VLMC_Rep::vlmc_s_tree) {
+    return calculate_cluster_distance<vlmc_container::VLMC_S_tree>(arguments, nr_cores, metrics, loaded_paths);
   }
   else if (vlmc_container == parser::VLMC_Rep::vlmc_sorted_search) {
-    return calculate_cluster_distance<vlmc_container::VLMC_sorted_search>(arguments, nr_cores);
+    return calculate_cluster_distance<vlmc_container::VLMC_sorted_search>(arguments, nr_cores, metrics, loaded_paths);
+  }
+  else if (vlmc_container == parser::VLMC_Rep::vlmc_quantized_16) {
+    return calculate_cluster_distance<vlmc_container::VLMC_quantized<int16_t>>(arguments, nr_cores, metrics, loaded_paths);
+  }
+  else if (vlmc_container == parser::VLMC_Rep::vlmc_quantized_8) {
+    return calculate_cluster_distance<vlmc_container::VLMC_quantized<int8_t>>(arguments, nr_cores, metrics, loaded_paths);
+  }
+  else if (vlmc_container == parser::VLMC_Rep::vlmc_rank_bitvector) {
+    return calculate_cluster_distance<vlmc_container::VLMC_rank_bitvector>(arguments, nr_cores, metrics, loaded_paths);
+  }
+  else if (vlmc_container == parser::VLMC_Rep::vlmc_context_trie) {
+    return calculate_cluster_distance<vlmc_container::VLMC_context_trie>(arguments, nr_cores, metrics, loaded_paths);
   }
   else if (vlmc_container == parser::VLMC_Rep::vlmc_kmer_major) {
-    return calculate_kmer_major(arguments, nr_cores);
+    return calculate_kmer_major(arguments, nr_cores, metrics, loaded_paths);
+  }
+  else if (vlmc_container == parser::VLMC_Rep::vlmc_kmer_partitioned) {
+    return calculate_kmer_partitioned(arguments, nr_cores, metrics, loaded_paths);
+  }
+  else if (vlmc_container == parser::VLMC_Rep::vlmc_query_table) {
+    return calculate_query_tables(arguments, nr_cores, metrics, loaded_paths);
+  }
+}
+
+/*
+  Builds the tree of the single cluster from the first metric and writes it
+  as Newick, the leaves named after the files of the loaded VLMCs.
+*/
+void build_tree(parser::cli_arguments arguments, const size_t nr_cores, distances_t& distance_matrices,
+  const std::vector<std::filesystem::path>& paths) {
+  std::vector<std::string> names{};
+  for (auto& path : paths) {
+    names.push_back(path.stem().string());
+  }
+
+  tree::Tree tree{};
+  {
+    perf::Phase_Timer timer{ perf::Phase::phase_tree };
+    trace::Scope span{ "tree_build" };
+    // The matrix is no longer needed, so the tree builds in its memory.
+    tree = tree::build(std::move(distance_matrices[0]), arguments.tree, nr_cores);
+  }
+  std::ofstream file{ arguments.newick_path };
+  tree::write_newick(file, tree, names);
+  std::string method_name{};
+  for (auto& [name, method] : parser::tree_method_map()) {
+    if (method == arguments.tree) {
+      method_name = name;
+    }
+  }
+  std::cout << "Wrote " << method_name << " tree to: " << arguments.newick_path.string() << std::endl;
+}
+
+/*
+  Maximum absolute error of each metric with 16 and 8 bit probabilities
+  against the double precision sorted vector, printed and added to the
+  performance report.
+*/
+template <typename... Metrics>
+void validate_quantization(parser::cli_arguments arguments, const size_t nr_cores, distance::metric::metric_list<Metrics...> metrics) {
+  auto reference = calculate_cluster_distance<vlmc_container::VLMC_sorted_search>(arguments, nr_cores, metrics);
+  auto names = distance::metric::names(metrics);
+  std::string json = "{";
+  for (auto [bits, rep] : { std::pair{ 16, parser::VLMC_Rep::vlmc_quantized_16 }, std::pair{ 8, parser::VLMC_Rep::vlmc_quantized_8 } }) {
+    auto quantized = apply_container(arguments, rep, nr_cores, metrics);
+    std::cout << "Max absolute error with " << bits << " bit probabilities:";
+    json += std::string(json.size() > 1 ? ", " : "") + "\"int" + std::to_string(bits) + "\": {";
+    for (size_t m = 0; m < names.size(); m++) {
+      out_t error = reference[m].size() == 0 ? 0.0 : (quantized[m] - reference[m]).cwiseAbs().maxCoeff();
+      std::cout << " " << names[m] << " " << error;
+      json += std::string(m > 0 ? ", " : "") + "\"" + names[m] + "\": " + std::to_string(error);
+    }
+    std::cout << std::endl;
+    json += "}";
+  }
+  if (perf::enabled) {
+    perf::registry.add_section("quantization", json + "}");
+  }
+}
+
+/*
+  Maximum absolute error of each metric against the dataset of the same name
+  in reference, typically written by a double precision build of the same
+  comparison. Printed and added to the performance report.
+*/
+void compare_to_reference(const std::filesystem::path& reference, const distances_t& distances,
+  const std::vector<std::string>& metric_names) {
+  HighFive::File file{ reference.string(), HighFive::File::ReadOnly };
+  auto distance_group = file.getGroup("distances");
+  std::string json = "{\"precision\": \"" + std::string(precision_name) + "\"";
+  std::cout << "Max absolute error (" << precision_name << " precision) against " << reference.string() << ":";
+  for (size_t m = 0; m < distances.size(); m++) {
+    auto name = dataset_name(metric_names[m]);
+    if (!distance_group.exist(name)) {
+      std::cerr << "Warning: no dataset " << name << " in " << reference.string() << std::endl;
+      continue;
+    }
+    Eigen::MatrixXd expected{};
+    distance_group.getDataSet(name).read(expected);
+    if (expected.rows() != distances[m].rows() || expected.cols() != distances[m].cols()) {
+      std::cerr << "Warning: dataset " << name << " in " << reference.string() << " has a different shape" << std::endl;
+      continue;
+    }
+    double error = expected.size() == 0 ? 0.0 : (distances[m].cast<double>() - expected).cwiseAbs().maxCoeff();
+    std::cout << " " << metric_names[m] << " " << error;
+    json += ", \"" + metric_names[m] + "\": " + std::to_string(error);
+  }
+  std::cout << std::endl;
+  if (perf::enabled) {
+    perf::registry.add_section("precision", json + "}");
   }
 }
 
@@ -73,6 +335,67 @@ int main(int argc, char* argv[]) {
   catch (const CLI::ParseError& e) {
     return app.exit(e);
   }
+  if (app.got_subcommand("merge")) {
+    try {
+      shard_file::merge(arguments.merge_paths, arguments.out_path);
+    }
+    catch (const std::exception& e) {
+      std::cerr << "Error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << "Merged " << arguments.merge_paths.size() << " shards into: " << arguments.out_path.string() << std::endl;
+    return EXIT_SUCCESS;
+  }
+  if (app.got_subcommand("catalog")) {
+    try {
+      catalog::Catalog previous{};
+      if (catalog::is_catalog(arguments.out_path)) {
+        previous = catalog::read(arguments.out_path);
+      }
+      size_t nr_unchanged = 0;
+      auto collection = catalog::build(arguments.catalog_directory, parser::parse_dop(arguments.dop), previous, nr_unchanged);
+      catalog::write(arguments.out_path, collection);
+      std::cout << "Cataloged " << collection.entries.size() << " VLMCs (" << nr_unchanged << " unchanged) to: "
+        << arguments.out_path.string() << std::endl;
+    }
+    catch (const std::exception& e) {
+      std::cerr << "Error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+  if (app.got_subcommand("pack")) {
+    try {
+      auto paths = get_cluster::get_paths(arguments.pack_input);
+      bool nested = !catalog::is_catalog(arguments.pack_input);
+      if (std::filesystem::is_directory(arguments.pack_input)) {
+        std::sort(paths.begin(), paths.end());
+      }
+      // Members keep their path below a directory or bundle, catalogs may list files anywhere.
+      std::vector<std::string> names{};
+      for (auto& path : paths) {
+        names.push_back(nested ? path.lexically_relative(arguments.pack_input).string() : path.filename().string());
+      }
+      bundle::pack(paths, names, arguments.out_path);
+      std::cout << "Packed " << paths.size() << " VLMCs into: " << arguments.out_path.string() << std::endl;
+    }
+    catch (const std::exception& e) {
+      std::cerr << "Error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+  if (app.got_subcommand("unpack")) {
+    try {
+      auto nr_members = bundle::unpack(arguments.pack_input, arguments.out_path);
+      std::cout << "Unpacked " << nr_members << " VLMCs into: " << arguments.out_path.string() << std::endl;
+    }
+    catch (const std::exception& e) {
+      std::cerr << "Error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
   if (arguments.first_VLMC_path.empty()) {
     std::cerr
       << "Error: A input path to .bintree files has to be given for comparison operation."
@@ -80,15 +403,70 @@ int main(int argc, char* argv[]) {
     return EXIT_FAILURE;
   }
 
+  if (!arguments.shard.empty()) {
+    if (arguments.out_path.empty() || arguments.vlmc == parser::VLMC_Rep::vlmc_kmer_major ||
+      arguments.vlmc == parser::VLMC_Rep::vlmc_kmer_partitioned || arguments.vlmc == parser::VLMC_Rep::vlmc_query_table) {
+      std::cerr << "Error: '--shard' needs an output path ('-o') and does not support kmer-major, kmer-partitioned or query-table." << std::endl;
+      return EXIT_FAILURE;
+    }
+    try {
+      shard::parse(arguments.shard);
+    }
+    catch (const std::exception& e) {
+      std::cerr << "Error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (arguments.build_tree && (!arguments.second_VLMC_path.empty() || !arguments.shard.empty())) {
+    std::cerr << "Error: '--tree' needs the distances of a single directory and does not support '--shard'." << std::endl;
+    return EXIT_FAILURE;
+  }
+
   size_t nr_cores = parser::parse_dop(arguments.dop);
+  perf::enabled = !arguments.perf_report_path.empty() || arguments.hw_counters;
+  trace::enabled = !arguments.trace_path.empty();
+  bloom::false_positive_rate = arguments.filter_fpr;
+  if (arguments.hw_counters) {
+    hw_collector = std::make_unique<hw_counters::Collector>();
+    if (!hw_collector->available()) {
+      hw_collector.reset();
+    }
+  }
 
-  matrix_t distance_matrix = apply_container(arguments, arguments.vlmc, nr_cores);
+  numa::Numa_Stats numa_before{};
+  if (arguments.numa || arguments.numa_fake_nodes > 0) {
+    numa::enabled = true;
+    numa::topology = arguments.numa_fake_nodes > 0 ? numa::fake_topology(arguments.numa_fake_nodes) : numa::detect();
+    std::cout << "NUMA mode with " << numa::topology.nr_nodes() << (numa::topology.fake ? " fake" : "") << " node(s)." << std::endl;
+    numa_before = numa::read_stats();
+  }
+
+  std::vector<std::string> metric_names{};
+  // The VLMCs of the first directory as they were loaded, which name the leaves of the tree.
+  std::vector<std::filesystem::path> loaded_paths{};
+  distances_t distance_matrices = distance::metric::dispatch(parser::metric_mask(arguments.metrics), [&](auto metrics) {
+    metric_names = distance::metric::names(metrics);
+    if (arguments.validate_quantization && arguments.shard.empty()) {
+      validate_quantization(arguments, nr_cores, metrics);
+    }
+    return apply_container(arguments, arguments.vlmc, nr_cores, metrics, &loaded_paths);
+  });
+
+  if (!arguments.reference_path.empty() && arguments.shard.empty()) {
+    compare_to_reference(arguments.reference_path, distance_matrices, metric_names);
+  }
 
   if (arguments.out_path.empty()) {
-    // utils::print_matrix(distance_matrix);
+    // utils::print_matrix(distance_matrices[0]);
+  }
+  else if (!arguments.shard.empty()) {
+    std::cout << "Wrote shard " << arguments.shard << " to: " << arguments.out_path.string() << std::endl;
   }
   else if (arguments.out_path.extension() == ".h5" ||
     arguments.out_path.extension() == ".hdf5") {
+    perf::Phase_Timer timer{ perf::Phase::phase_hdf5_write };
+    trace::Scope span{ "hdf5_write" };
     HighFive::File file{arguments.out_path, HighFive::File::OpenOrCreate};
 
     if (!file.exist("distances")) {
@@ -96,16 +474,38 @@ int main(int argc, char* argv[]) {
     }
     auto distance_group = file.getGroup("distances");
 
-    if (!distance_group.exist("distances")) {
-      std::vector<size_t> dims{distance_matrix.rows(), distance_matrix.cols()};
-      distance_group.createDataSet<double>("distances",
-        HighFive::DataSpace(dims));
-    }
+    for (size_t m = 0; m < distance_matrices.size(); m++) {
+      auto& distance_matrix = distance_matrices[m];
+      auto name = dataset_name(metric_names[m]);
+      if (!distance_group.exist(name)) {
+        std::vector<size_t> dims{distance_matrix.rows(), distance_matrix.cols()};
+        distance_group.createDataSet<out_t>(name,
+          HighFive::DataSpace(dims));
+      }
 
-    auto distance_data_set = distance_group.getDataSet("distances");
-    distance_data_set.write(distance_matrix);
+      auto distance_data_set = distance_group.getDataSet(name);
+      distance_data_set.write(distance_matrix);
+    }
     std::cout << "Wrote distances to: " << arguments.out_path.string() << std::endl;
   }
 
+  if (arguments.build_tree) {
+    build_tree(arguments, nr_cores, distance_matrices, loaded_paths);
+  }
+
+  if (trace::enabled) {
+    trace::write_trace(arguments.trace_path);
+    std::cout << "Wrote trace to: " << arguments.trace_path.string() << std::endl;
+  }
+
+  if (numa::enabled && perf::enabled) {
+    perf::registry.add_section("numa", numa::to_json(numa_before, numa::read_stats()));
+  }
+
+  if (!arguments.perf_report_path.empty()) {
+    perf::write_report(arguments.perf_report_path);
+    std::cout << "Wrote performance report to: " << arguments.perf_report_path.string() << std::endl;
+  }
+
   return EXIT_SUCCESS;
 }
\ No newline at end of file
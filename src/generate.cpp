@@ -0,0 +1,57 @@
+#include <iostream>
+#include <map>
+
+#include "CLI/App.hpp"
+#include "CLI/Config.hpp"
+#include "CLI/Formatter.hpp"
+
+#include "parser.hpp"
+#include "vlmc_generator.hpp"
+
+int main(int argc, char* argv[]) {
+  CLI::App app{"Generates a directory of synthetic VLMCs in the .bintree format."};
+
+  std::filesystem::path out_path{};
+  size_t nr_vlmcs{ 10 };
+  size_t dop{ 1 };
+  vlmc_generator::Generator_Settings settings{};
+
+  std::map<std::string, vlmc_generator::Count_Distribution> count_map{
+    {"uniform", vlmc_generator::Count_Distribution::counts_uniform},
+    { "geometric", vlmc_generator::Count_Distribution::counts_geometric }};
+
+  app.add_option("-o,--out-path", out_path, "Directory the .bintree files are written to.")->required();
+  app.add_option("-c,--count", nr_vlmcs, "Number of VLMCs to generate.");
+  app.add_option("-n,--max-dop", dop, "Degree of parallelism. Default 1 (sequential).");
+  app.add_option("--contexts", settings.nr_contexts, "Number of contexts per VLMC, fewer if pruning exhausts the tree.");
+  app.add_option("--overlap", settings.overlap, "Fraction of the contexts shared by all VLMCs.")
+    ->check(CLI::Range(0.0, 1.0));
+  app.add_option("--min-depth", settings.min_depth, "All contexts up to this depth are present, use >= the background order.");
+  // Context keys are ints, which hold contexts of up to 15 symbols.
+  app.add_option("--max-depth", settings.max_depth, "Maximum context length, at most 15.")
+    ->check(CLI::Range(1, 15));
+  app.add_option("--pruning", settings.pruning, "Probability that a candidate context and its subtree are pruned.")
+    ->check(CLI::Range(0.0, 1.0));
+  app.add_option("--depth-bias", settings.depth_bias, "Probability to extend the newest context, higher gives deeper trees.")
+    ->check(CLI::Range(0.0, 1.0));
+  app.add_option("--counts", settings.count_distribution, "Distribution of the next symbol counts, 'uniform' or 'geometric'.")
+    ->transform(CLI::CheckedTransformer(count_map, CLI::ignore_case));
+  app.add_option("--max-count", settings.max_count, "Largest next symbol count.");
+  app.add_option("--seed", settings.seed, "Seed, the output is deterministic given the seed and the other options.");
+
+  try {
+    app.parse(argc, argv);
+  }
+  catch (const CLI::ParseError& e) {
+    return app.exit(e);
+  }
+  if (settings.min_depth > settings.max_depth) {
+    std::cerr << "Error: --min-depth can not be larger than --max-depth." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  auto paths = vlmc_generator::generate_directory(out_path, nr_vlmcs, settings, parser::parse_dop(dop));
+  std::cout << "Wrote " << paths.size() << " VLMCs to: " << out_path.string() << std::endl;
+
+  return EXIT_SUCCESS;
+}
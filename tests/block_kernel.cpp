@@ -0,0 +1,72 @@
+#include <cmath>
+#include <limits>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <filesystem>
+#include <unistd.h>
+
+#include "calc_dists.hpp"
+#include "get_cluster.hpp"
+#include "vlmc_generator.hpp"
+
+/*
+  Distances of calculate_row with the block kernel against those of every
+  pair computed on its own, for sorted-vector and sbs. Sorted-vector must give
+  identical distances, sbs the same up to rounding in the accumulation
+  precision. The skewed references are 8 times larger than the queries, which
+  sbs leaves to its galloping search.
+*/
+using Metrics = distance::metric::metric_list<distance::metric::Dvstar, distance::metric::Euclidean,
+  distance::metric::Cosine, distance::metric::D2>;
+
+int failures = 0;
+
+template <typename VC>
+void check(const char* name, const std::filesystem::path& left_directory, const std::filesystem::path& right_directory,
+  size_t background_order, double tolerance) {
+  auto left = get_cluster::get_cluster<VC>(left_directory, 1, background_order);
+  auto right = get_cluster::get_cluster<VC>(right_directory, 1, background_order);
+  auto block = calc_dist::calculate_distances<VC>(left, right, 1, Metrics{}, true);
+  auto pairwise = calc_dist::calculate_distances<VC>(left, right, 1, Metrics{}, false);
+  for (size_t m = 0; m < block.size(); m++) {
+    for (int i = 0; i < block[m].rows(); i++) {
+      for (int j = 0; j < block[m].cols(); j++) {
+        double difference = std::abs(double(block[m](i, j)) - double(pairwise[m](i, j)));
+        if (difference > tolerance * std::max(1.0, std::abs(double(pairwise[m](i, j))))) {
+          std::cerr << std::setprecision(17) << name << ", " << right_directory.filename().string() << ", background order " << background_order
+            << ", metric " << m << ", pair " << i << " " << j << ": " << block[m](i, j) << " against " << pairwise[m](i, j) << std::endl;
+          failures++;
+        }
+      }
+    }
+  }
+}
+
+int main() {
+  auto directory = std::filesystem::temp_directory_path() / ("block_kernel_" + std::to_string(getpid()));
+  vlmc_generator::Generator_Settings settings{};
+  settings.nr_contexts = 300;
+  settings.max_depth = 6;
+  settings.min_depth = 2;
+  auto queries = directory / "queries";
+  vlmc_generator::generate_directory(queries, 20, settings);
+  settings.nr_contexts = 2400;
+  settings.seed = 1;
+  auto skewed = directory / "skewed";
+  vlmc_generator::generate_directory(skewed, 4, settings);
+
+  for (size_t background_order : { 0, 2 }) {
+    for (auto& references : { queries, skewed }) {
+      check<vlmc_container::VLMC_sorted_vector>("sorted-vector", queries, references, background_order, 0.0);
+      check<vlmc_container::VLMC_sorted_search>("sbs", queries, references, background_order,
+        100 * std::numeric_limits<acc_t>::epsilon());
+    }
+  }
+  std::filesystem::remove_all(directory);
+  if (failures > 0) {
+    return EXIT_FAILURE;
+  }
+  std::cout << "block_kernel passed" << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "vlmc_containers/s_tree_array.hpp"
+
+/*
+  Searches of array::S_Tree for every key, between the keys and above the
+  largest one. The keys end right before a page without access, so a search
+  that reads past the last level faults instead of passing by chance.
+*/
+int failures = 0;
+
+void expect(bool condition, int n, int x, const char* what) {
+  if (!condition) {
+    std::cerr << "n = " << n << ", x = " << x << ": " << what << std::endl;
+    failures++;
+  }
+}
+
+void check(int n) {
+  std::vector<kmers::RI_Kmer> sorted{};
+  for (int i = 0; i < n; i++) {
+    sorted.emplace_back(3 * i + 1);
+  }
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t key_bytes = array::S_Tree::storage_size(n) * sizeof(int);
+  size_t pages = (key_bytes + page - 1) / page;
+  auto* mapping = static_cast<char*>(mmap(nullptr, (pages + 1) * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  mprotect(mapping + pages * page, page, PROT_NONE);
+  auto* keys = reinterpret_cast<int*>(mapping + pages * page - key_bytes);
+  std::vector<kmers::RI_Kmer> kmers(n);
+  array::S_Tree tree{ sorted, keys, kmers.data() };
+
+  std::vector<int> xs{};
+  for (int x = 0; x <= 3 * n + 1; x++) {
+    xs.push_back(x);
+  }
+  xs.push_back(INT_MAX - 1);
+  for (int x : xs) {
+    int expected = std::min(n, (x + 1) / 3);
+    expect(tree.search(x) == expected, n, x, "search");
+    int result = 0;
+    tree.search_batch(&x, &result, 1);
+    expect(result == expected, n, x, "search_batch");
+  }
+  munmap(mapping, (pages + 1) * page);
+}
+
+int main() {
+  for (int n : { 1, 15, 16, 17, 32, 100, 256, 257, 4096 }) {
+    check(n);
+  }
+  if (failures > 0) {
+    return EXIT_FAILURE;
+  }
+  std::cout << "s_tree_search passed" << std::endl;
+  return EXIT_SUCCESS;
+}